@@ -0,0 +1,164 @@
+#include "fs_admission.h"
+#include "helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+//FS_READ_PRIORITY: waiting reads go before waiting writes
+static bool read_priority;
+
+//A request waiting for its turn
+struct Waiter {
+	std::condition_variable ready_cv;
+	bool ready = false;
+	bool is_read;
+	double tag;		//virtual start time, smallest goes first
+};
+
+//One user's waiting requests and share of the server
+struct User_queue {
+	std::deque<Waiter*> writes;
+	std::deque<Waiter*> reads;
+	double weight = 1;
+	double last_tag = 0;	//tag of the user's latest request
+
+	size_t waiting() const {
+		return writes.size() + reads.size();
+	}
+	//The queue holding the user's next request to run
+	std::deque<Waiter*> &next_queue() {
+		if(reads.empty() || (!writes.empty() && !read_priority &&
+		   writes.front()->tag < reads.front()->tag)) {
+			return writes;
+		}
+		return reads;
+	}
+};
+
+static unsigned int max_active;
+static unsigned int user_queue_limit;
+static std::unordered_map<std::string, double> user_weights;
+static std::mutex admission_lock;
+static std::unordered_map<std::string, User_queue> users;
+static unsigned int running = 0;
+static unsigned int waiting_total = 0;
+static double virtual_time = 0;
+
+//Parses FS_USER_WEIGHTS, e.g. "alice=4,bob=2"
+static void parse_weights(const char *spec) {
+	std::string entries(spec);
+	size_t pos = 0;
+	while(pos < entries.size()) {
+		size_t end = entries.find(',', pos);
+		if(end == std::string::npos) {
+			end = entries.size();
+		}
+		std::string entry = entries.substr(pos, end - pos);
+		size_t eq = entry.find('=');
+		double weight = (eq == std::string::npos) ? 0 : atof(entry.c_str() + eq + 1);
+		if(weight > 0) {
+			user_weights[entry.substr(0, eq)] = weight;
+		}
+		else {
+			fprintf(stderr, "FS_USER_WEIGHTS: ignoring '%s'\n", entry.c_str());
+		}
+		pos = end + 1;
+	}
+}
+
+void init_admission() {
+	long cores = std::max(1u, std::thread::hardware_concurrency());
+	max_active = std::max(1L, env_option("FS_MAX_ACTIVE", 2 * cores));
+	user_queue_limit = std::max(0L, env_option("FS_USER_QUEUE", 64));
+	read_priority = env_option("FS_READ_PRIORITY", 0) != 0;
+	const char *weights = getenv("FS_USER_WEIGHTS");
+	if(weights != nullptr) {
+		parse_weights(weights);
+	}
+}
+
+/*
+	Lets waiting requests run while there are free slots.  The waiting
+	request with the smallest tag goes first, or with FS_READ_PRIORITY the
+	waiting read with the smallest tag.  Called with admission_lock held.
+*/
+static void dispatch() {
+	while(running < max_active && waiting_total > 0) {
+		std::deque<Waiter*> *best = nullptr;
+		bool best_read = false;
+		for(auto it = users.begin(); it != users.end(); ) {
+			User_queue &user = it->second;
+			//A user with nothing waiting and no credit left is forgotten
+			if(user.waiting() == 0) {
+				if(user.last_tag <= virtual_time) {
+					it = users.erase(it);
+				}
+				else {
+					++it;
+				}
+				continue;
+			}
+			std::deque<Waiter*> &queue = user.next_queue();
+			bool queue_read = read_priority && queue.front()->is_read;
+			if(best == nullptr || queue_read > best_read ||
+			   (queue_read == best_read && queue.front()->tag < best->front()->tag)) {
+				best = &queue;
+				best_read = queue_read;
+			}
+			++it;
+		}
+
+		Waiter *next = best->front();
+		best->pop_front();
+		waiting_total--;
+		running++;
+		virtual_time = std::max(virtual_time, next->tag);
+		next->ready = true;
+		next->ready_cv.notify_one();
+	}
+}
+
+bool admit_request(const std::string &username, bool is_read) {
+	std::unique_lock<std::mutex> lck(admission_lock);
+	User_queue &user = users[username];
+	if(user.last_tag == 0) {
+		auto weight = user_weights.find(username);
+		user.weight = (weight == user_weights.end()) ? 1 : weight->second;
+	}
+
+	//Start-time fair queueing: a user's requests are spaced 1/weight apart
+	//in virtual time, and an idle user starts again from the present
+	Waiter waiter;
+	waiter.is_read = is_read;
+	waiter.tag = std::max(virtual_time, user.last_tag);
+
+	if(running < max_active && waiting_total == 0) {
+		user.last_tag = waiter.tag + 1 / user.weight;
+		virtual_time = waiter.tag;
+		running++;
+		return true;
+	}
+	if(user.waiting() >= user_queue_limit) {
+		return false;
+	}
+
+	user.last_tag = waiter.tag + 1 / user.weight;
+	(is_read ? user.reads : user.writes).push_back(&waiter);
+	waiting_total++;
+	dispatch();
+	waiter.ready_cv.wait(lck, [&waiter] { return waiter.ready; });
+	return true;
+}
+
+void finish_request() {
+	std::lock_guard<std::mutex> lck(admission_lock);
+	running--;
+	dispatch();
+}
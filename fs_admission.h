@@ -0,0 +1,34 @@
+/*
+ * fs_admission.h
+ *
+ * Admission control for the file server.  Requests are run a few at a
+ * time; the rest wait in one bounded queue per user and are let in by
+ * weighted fair queueing, so one user's bulk job cannot starve the others.
+ */
+
+#ifndef _FS_ADMISSION_H_
+#define _FS_ADMISSION_H_
+
+#include <string>
+
+/*
+ * Reads the admission options from the environment:
+ *	FS_MAX_ACTIVE		requests run at once (default 2 per core)
+ *	FS_USER_QUEUE		requests one user may have waiting (default 64)
+ *	FS_USER_WEIGHTS		"user=weight,..." shares, users not listed get 1
+ *	FS_READ_PRIORITY	1 to let waiting reads go before waiting writes
+ * Called once before the server starts accepting connections.
+ */
+void init_admission();
+
+/*
+ * Waits until the scheduler lets a request from username run.
+ * Returns false at once, without waiting, if username already has a full
+ * queue; the request must then be answered as busy.
+ */
+bool admit_request(const std::string &username, bool is_read);
+
+//Called when an admitted request is done, letting the next one in
+void finish_request();
+
+#endif /* _FS_ADMISSION_H_ */
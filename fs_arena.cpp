@@ -0,0 +1,38 @@
+#include "fs_arena.h"
+#include "fs_param.h"
+
+#include <cstddef>
+#include <memory>
+
+//Enough for a read's response and the rest of any request but the biggest
+//deletes and copies, which spill into blocks taken from the heap
+static const size_t ARENA_BYTES = 2 * FS_BLOCKSIZE + 8192;
+
+//One per thread, built the first time the thread serves a request
+struct Thread_arena {
+	alignas(std::max_align_t) char buffer[ARENA_BYTES];
+	std::pmr::monotonic_buffer_resource resource{buffer, sizeof(buffer), std::pmr::new_delete_resource()};
+};
+
+static thread_local std::unique_ptr<Thread_arena> arena;
+static thread_local bool in_request = false;
+
+std::pmr::memory_resource *request_arena() {
+	if(!in_request) {
+		return std::pmr::new_delete_resource();
+	}
+	return &arena->resource;
+}
+
+Request_scope::Request_scope() {
+	if(!arena) {
+		arena.reset(new Thread_arena);
+	}
+	in_request = true;
+}
+
+Request_scope::~Request_scope() {
+	in_request = false;
+	//Back to the start of the buffer, freeing any blocks that spilled
+	arena->resource.release();
+}
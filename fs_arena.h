@@ -0,0 +1,45 @@
+/*
+ * fs_arena.h
+ *
+ * Request-scoped memory.  Each server thread has an arena that the
+ * temporaries of the request it is serving (path components, strings,
+ * block lists and the response) are carved from.  The arena is reset in
+ * one step when the request ends, so serving a steady stream of requests
+ * does no heap allocation and threads never contend in malloc.
+ */
+
+#ifndef _FS_ARENA_H_
+#define _FS_ARENA_H_
+
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+//Strings and lists a request builds; made with request_arena()
+typedef std::pmr::string Req_string;
+typedef std::pmr::vector<Req_string> Path_list;		//components of a path
+typedef std::pmr::vector<uint32_t> Block_list;
+
+/*
+ * The arena of the request this thread is serving, or the ordinary heap
+ * when it is not inside a Request_scope, so background threads can use
+ * the same functions without their memory piling up.
+ */
+std::pmr::memory_resource *request_arena();
+
+/*
+ * Marks the request being served on this thread.  Everything taken from
+ * request_arena() meanwhile is given back at once when the scope ends,
+ * so nothing allocated from it may outlive the scope.
+ */
+class Request_scope
+{
+	public:
+		Request_scope();
+		Request_scope(const Request_scope &) = delete;
+		Request_scope &operator=(const Request_scope &) = delete;
+		~Request_scope();
+};
+
+#endif /* _FS_ARENA_H_ */
@@ -0,0 +1,222 @@
+/*
+ * fs_bench
+ *
+ * Microbenchmarks for the request parsing and file system hot paths, run
+ * on an in-memory disk (ram_disk.cpp) with no sockets involved.
+ *
+ * Every benchmark runs a fixed number of operations, repeated and reported
+ * as the median time per operation, so runs on the same machine can be
+ * compared.  With more than one thread, the time is wall time divided by
+ * the operations of all threads together.
+ *
+ * Usage: fs_bench [-r repeats] [-n operations] [filter]
+ *	-r repeats	runs of each benchmark, the median is reported (default 5)
+ *	-n operations	operations per thread in each run (default 2000)
+ *	filter		only run benchmarks whose name contains this
+ */
+
+#include "fs_server.h"
+#include "fs_socket.h"
+#include "fs_filesystem.h"
+#include "fs_device.h"
+#include "ram_disk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+extern std::queue<uint32_t> free_blocks;
+extern std::unordered_map<uint32_t, uint32_t> block_refs;
+extern std::unordered_map<int, std::mutex> inode_locks;
+
+static const char *BENCH_USER = "bench";
+
+static unsigned int repeats = 5;
+static unsigned int operations = 2000;
+static const char *filter = "";
+
+//Starts every benchmark from an empty file system
+static void reset_fs() {
+	ram_disk_format();
+	std::queue<uint32_t>().swap(free_blocks);
+	block_refs.clear();
+	init();
+}
+
+//Runs one request the way handle_connection does, for building trees
+static bool run_request(const std::string &request) {
+	std::vector<char> msg(request.begin(), request.end());
+	msg.push_back('\0');
+	Request_scope request_scope;
+	Path_list paths(request_arena());
+	char block_data[FS_BLOCKSIZE] = {};
+	return parse_request(msg.data(), request.size(), paths) &&
+	       generate_response(msg.data(), request.size(), paths, block_data) != "";
+}
+
+//"/d1/d2/.../d<depth-1>", the directories above a file at that depth
+static std::string dir_path(unsigned int depth) {
+	std::string path;
+	for(unsigned int i = 1; i < depth; ++i) {
+		path += "/d" + std::to_string(i);
+	}
+	return path;
+}
+
+//Creates the directories above a file at depth, and dir_size files in the last
+static void build_tree(unsigned int depth, unsigned int dir_size) {
+	for(unsigned int i = 1; i < depth; ++i) {
+		run_request("FS_CREATE " + std::string(BENCH_USER) + " " + dir_path(i + 1) + " d");
+	}
+	for(unsigned int i = 0; i < dir_size; ++i) {
+		run_request("FS_CREATE " + std::string(BENCH_USER) + " " + dir_path(depth) + "/f" + std::to_string(i) + " f");
+	}
+}
+
+/*
+	Times op(thread, i) for i in [0, operations) on each of threads threads
+	and prints the median nanoseconds per operation over the repeats.
+	setup runs before every repeat and is not timed.
+*/
+static void bench(const std::string &name, const std::string &params, unsigned int threads,
+                  const std::function<void()> &setup,
+                  const std::function<void(unsigned int, unsigned int)> &op) {
+	if(name.find(filter) == std::string::npos) {
+		return;
+	}
+	std::vector<double> results;
+	for(unsigned int r = 0; r < repeats; ++r) {
+		setup();
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> workers;
+		for(unsigned int t = 0; t < threads; ++t) {
+			workers.emplace_back([&op, t] {
+				for(unsigned int i = 0; i < operations; ++i) {
+					op(t, i);
+				}
+			});
+		}
+		for(std::thread &worker : workers) {
+			worker.join();
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		results.push_back(elapsed.count() / ((double)operations * threads));
+	}
+	std::sort(results.begin(), results.end());
+	printf("%-16s %-28s %12.1f ns/op\n", name.c_str(), params.c_str(), results[results.size() / 2]);
+	fflush(stdout);
+}
+
+static void bench_parse() {
+	for(unsigned int depth : {1, 4, 8}) {
+		std::string request = "FS_READBLOCK " + std::string(BENCH_USER) + " " + dir_path(depth) + "/file 7";
+		bench("parse_request", "depth=" + std::to_string(depth), 1, [] {},
+			[&request](unsigned int, unsigned int) {
+				char msg[MAX_MESSAGE_SIZE + 1];
+				memcpy(msg, request.c_str(), request.size() + 1);
+				Request_scope request_scope;
+				Path_list paths(request_arena());
+				if(!parse_request(msg, request.size(), paths)) {
+					abort();
+				}
+			});
+		std::string pathname = dir_path(depth) + "/file";
+		bench("check_size", "depth=" + std::to_string(depth), 1, [] {},
+			[&pathname](unsigned int, unsigned int) {
+				Request_scope request_scope;
+				Path_list paths(request_arena());
+				if(!check_size(paths, "FS_READBLOCK", BENCH_USER, pathname, "")) {
+					abort();
+				}
+			});
+	}
+}
+
+//Traversal to the last file of a directory, the worst case for find_node
+static void bench_traversal() {
+	for(unsigned int depth : {1, 4, 8}) {
+		for(unsigned int dir_size : {8, 64, 512}) {
+			for(unsigned int threads : {1, 4}) {
+				Path_list paths;
+				check_size(paths, "FS_READBLOCK", BENCH_USER, dir_path(depth) + "/f" + std::to_string(dir_size - 1), "");
+				char params[64];
+				snprintf(params, sizeof(params), "depth=%u dir=%u threads=%u", depth, dir_size, threads);
+				bench("pathTraversal", params, threads,
+					[depth, dir_size] { reset_fs(); build_tree(depth, dir_size); },
+					[&paths](unsigned int, unsigned int) {
+						Lock_RAII lck(&inode_locks[0]);
+						fs_inode node;
+						if(pathTraversal(paths, node, "FS_READBLOCK", BENCH_USER, lck) == fs_disksize) {
+							abort();
+						}
+					});
+			}
+		}
+	}
+}
+
+//Each operation creates a file and the next one deletes it again, so the
+//directory keeps about the same size; threads use their own names
+static void bench_create_delete() {
+	for(unsigned int dir_size : {8, 64, 512}) {
+		for(unsigned int threads : {1, 4}) {
+			unsigned int depth = 2;
+			char params[64];
+			snprintf(params, sizeof(params), "depth=%u dir=%u threads=%u", depth, dir_size, threads);
+			Path_list parent;
+			check_size(parent, "FS_CREATE", BENCH_USER, dir_path(depth) + "/x", "");
+			bench("create+delete", params, threads,
+				[depth, dir_size] { reset_fs(); build_tree(depth, dir_size); },
+				[&parent](unsigned int thread, unsigned int i) {
+					Request_scope request_scope;
+					Lock_RAII lck(&inode_locks[0]);
+					fs_inode dir;
+					uint32_t dir_num = pathTraversal(parent, dir, "FS_CREATE", BENCH_USER, lck);
+					std::string name = "t" + std::to_string(thread);
+					bool done = (i % 2 == 0)
+						? create_path(name, dir, dir_num, BENCH_USER, 'f')
+						: delete_path(dir, dir_num, name, BENCH_USER);
+					if(dir_num == fs_disksize || !done) {
+						abort();
+					}
+				});
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	while((opt = getopt(argc, argv, "r:n:")) != -1) {
+		if(opt == 'r' && atoi(optarg) > 0) {
+			repeats = atoi(optarg);
+		}
+		else if(opt == 'n' && atoi(optarg) > 0) {
+			operations = atoi(optarg);
+		}
+		else {
+			fprintf(stderr, "Usage: %s [-r repeats] [-n operations] [filter]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(optind < argc) {
+		filter = argv[optind];
+	}
+	//Keep the operations even, so create+delete ends where it started
+	operations += operations % 2;
+
+	reset_fs();
+	bench_parse();
+	bench_traversal();
+	bench_create_delete();
+	return 0;
+}
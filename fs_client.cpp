@@ -0,0 +1,1097 @@
+#include "fs_client.h"
+#include "fs_shm.h"
+#include "helpers.h"		// make_client_sockaddr()
+
+#include <sys/socket.h>		// socket(), connect(), send(), recv()
+#include <netinet/tcp.h>	// TCP_NODELAY
+#include <poll.h>		// poll()
+#include <unistd.h>		// close()
+#include <stdio.h>		// perror()
+#include <stdlib.h>		// getenv(), atoi()
+#include <string.h>		// memcmp()
+#include <sys/mman.h>		// shm_open(), mmap()
+#include <sys/stat.h>		// fstat()
+#include <fcntl.h>		// O_RDWR
+#include <signal.h>		// kill()
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <unordered_map>
+
+//Number of connections kept open when neither fs_clientpoolsize nor
+//FS_CLIENT_POOL_SIZE says otherwise
+static const unsigned int DEFAULT_POOL_SIZE = 8;
+
+//What the server sends (with its NULL) instead of the echoed request when a
+//request fails
+static const char ERROR_RESPONSE[] = "FS_ERROR";
+
+//What the server sends instead when the user has too many requests waiting
+static const char BUSY_RESPONSE[] = "FS_AGAIN";
+
+//Sent on a connection of its own to make it a lease holder's, and the
+//start of the server's answer
+static const char LEASE_REQUEST[] = "FS_LEASES";
+
+//Opens a new connection to the server, -1 on failure
+static int connect_server(const struct sockaddr_in &addr)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd == -1) {
+		perror("socket");
+		return -1;
+	}
+	if(connect(fd, (const sockaddr *) &addr, sizeof(addr)) == -1) {
+		perror("connect");
+		close(fd);
+		return -1;
+	}
+	//Requests are small and often answered before the next one is sent
+	int yesval = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yesval, sizeof(yesval));
+	return fd;
+}
+
+//An idle connection should have nothing to read; EOF means the server
+//closed it while nobody was using it
+static bool still_open(int fd)
+{
+	struct pollfd pfd = {fd, POLLIN, 0};
+	return poll(&pfd, 1, 0) == 0;
+}
+
+/*
+	Thread safe pool of persistent connections to the file server.
+	A connection is checked out for exactly one request/response and
+	handed back afterwards.  Connections the server closed (failed
+	request, server restart) are dropped and replaced on demand.
+*/
+class Connection_pool
+{
+	public:
+
+		//Resolves the server once so new connections only pay connect()
+		int init(const char *hostname, uint16_t port)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			if(initialized) {
+				return -1;
+			}
+			if(make_client_sockaddr(&addr, hostname, port) == -1) {
+				return -1;
+			}
+			const char *env_size = getenv("FS_CLIENT_POOL_SIZE");
+			if(env_size && atoi(env_size) > 0) {
+				max_size = atoi(env_size);
+			}
+			initialized = true;
+			return 0;
+		}
+
+		//Copies the server's address into out, false before init
+		bool server_address(struct sockaddr_in &out)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			out = addr;
+			return initialized;
+		}
+
+		unsigned int size()
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			return max_size;
+		}
+
+		void set_size(unsigned int size)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			max_size = size;
+			while(open > max_size && !idle.empty()) {
+				close(idle.back());
+				idle.pop_back();
+				open--;
+			}
+			available.notify_all();
+		}
+
+		/*	Returns a connected socket, or -1 if the server can't be reached
+			reused: set to true if the socket was used by an earlier request	*/
+		int acquire(bool &reused)
+		{
+			std::unique_lock<std::mutex> lck(lock);
+			if(!initialized) {
+				return -1;
+			}
+			while(true) {
+				while(!idle.empty()) {
+					int fd = idle.back();
+					idle.pop_back();
+					if(still_open(fd)) {
+						reused = true;
+						return fd;
+					}
+					close(fd);
+					open--;
+				}
+				if(open < max_size) {
+					break;
+				}
+				available.wait(lck);
+			}
+			//Reserve the slot before dropping the lock to connect
+			open++;
+			lck.unlock();
+			reused = false;
+			int fd = connect_server(addr);
+			if(fd == -1) {
+				release(-1, false);
+			}
+			return fd;
+		}
+
+		//healthy: false if fd is in an unknown state and must not be reused
+		void release(int fd, bool healthy)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			if(healthy && open <= max_size) {
+				idle.push_back(fd);
+			}
+			else {
+				if(fd != -1) {
+					close(fd);
+				}
+				open--;
+			}
+			available.notify_one();
+		}
+
+	private:
+
+		std::mutex lock;
+		std::condition_variable available;
+		std::vector<int> idle;
+		unsigned int open = 0;		//idle + checked out connections
+		unsigned int max_size = DEFAULT_POOL_SIZE;
+		bool initialized = false;
+		struct sockaddr_in addr;
+};
+
+static Connection_pool pool;
+
+//A read replica, once fs_clientinit_replica succeeds
+static Connection_pool replica_pool;
+
+//Sends all of buf, false on failure
+static bool send_all(int fd, const char *buf, size_t size)
+{
+	while(size > 0) {
+		ssize_t rval = send(fd, buf, size, MSG_NOSIGNAL);
+		if(rval <= 0) {
+			return false;
+		}
+		buf += rval;
+		size -= rval;
+	}
+	return true;
+}
+
+//Receives exactly size bytes into buf, false on failure or early close
+static bool recv_all(int fd, char *buf, size_t size)
+{
+	while(size > 0) {
+		ssize_t rval = recv(fd, buf, size, 0);
+		if(rval <= 0) {
+			return false;
+		}
+		buf += rval;
+		size -= rval;
+	}
+	return true;
+}
+
+/*
+	Receives the server's answer to one request.
+	expected: the request including its NULL, which the server echoes
+	data_in: where to put the block following the response, or nullptr
+	Returns 0 on success, -1 if the server reported a failure, -2 if the
+	connection is broken or out of step with the server, -3 if the server
+	was busy (or is a follower too far behind) and did nothing
+*/
+static int recv_response(int fd, const std::vector<char> &expected, void *data_in)
+{
+	//Every echo is longer than the error response, so read that much first
+	char head[sizeof(ERROR_RESPONSE)];
+	if(!recv_all(fd, head, sizeof(head))) {
+		return -2;
+	}
+	static_assert(sizeof(BUSY_RESPONSE) == sizeof(ERROR_RESPONSE), "responses must be the same length");
+	if(memcmp(head, ERROR_RESPONSE, sizeof(head)) == 0) {
+		return -1;
+	}
+	if(memcmp(head, BUSY_RESPONSE, sizeof(head)) == 0) {
+		return -3;
+	}
+	std::vector<char> response(expected.size());
+	memcpy(response.data(), head, sizeof(head));
+	if(!recv_all(fd, response.data() + sizeof(head), response.size() - sizeof(head)) ||
+	   response != expected ||
+	   (data_in && !recv_all(fd, (char *)data_in, FS_BLOCKSIZE))) {
+		return -2;
+	}
+	return 0;
+}
+
+//The server's shared memory region, once fs_clientinit_shm succeeds
+static std::atomic<Shm_region *> shm_region(nullptr);
+
+//The shared memory channel a thread has claimed, given back when it exits
+struct Shm_claim
+{
+	~Shm_claim()
+	{
+		if(channel) {
+			channel->owner.store(0);
+		}
+	}
+
+	Shm_channel *channel = nullptr;
+	bool tried = false;
+};
+
+static thread_local Shm_claim shm_claim;
+
+//False once the thread or process id is gone
+static bool still_running(pid_t id)
+{
+	return kill(id, 0) == 0 || errno != ESRCH;
+}
+
+//Waits for the server to answer a channel's requests up to posted,
+//false if the server exits first
+static bool wait_answer(Shm_region *region, Shm_channel &channel, uint32_t posted)
+{
+	for(unsigned int spins = 0; channel.answered.load(std::memory_order_acquire) != posted; ++spins) {
+		if(spins < SHM_SPINS) {
+			shm_pause();
+			continue;
+		}
+		channel.client_sleeping.store(1);
+		uint32_t answered = channel.answered.load();
+		if(answered != posted) {
+			shm_wait(channel.answered, answered, 1000);
+		}
+		channel.client_sleeping.store(0, std::memory_order_relaxed);
+		if(!still_running(region->server_pid.load())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//Takes a free channel, or one left by a thread that has exited, nullptr if none
+static Shm_channel *claim_channel(Shm_region *region)
+{
+	uint32_t tid = syscall(SYS_gettid);
+	for(unsigned int i = 0; i < SHM_CHANNELS; ++i) {
+		Shm_channel &channel = region->channel[i];
+		uint32_t owner = channel.owner.load();
+		if(owner != 0 && still_running(owner)) {
+			continue;
+		}
+		if(!channel.owner.compare_exchange_strong(owner, tid)) {
+			continue;
+		}
+		//A thread that died mid request leaves its answer to come first
+		if(!wait_answer(region, channel, channel.posted.load())) {
+			channel.owner.store(0);
+			return nullptr;
+		}
+		return &channel;
+	}
+	return nullptr;
+}
+
+/*
+	Runs one request over the thread's shared memory channel.
+	Arguments as for fs_common
+	Returns 0 on success, -1 on failure, -2 if this thread has no channel
+	and the request must go over a connection instead
+*/
+static int shm_common(const std::string &request, const void *data_out, void *data_in)
+{
+	Shm_region *region = shm_region.load();
+	if(!region) {
+		return -2;
+	}
+	if(!shm_claim.tried) {
+		shm_claim.tried = true;
+		shm_claim.channel = claim_channel(region);
+	}
+	Shm_channel *channel = shm_claim.channel;
+	if(!channel) {
+		return -2;
+	}
+	if(request.size() >= SHM_MAX_REQUEST) {
+		return -1;
+	}
+
+	uint32_t posted = channel->posted.load(std::memory_order_relaxed);
+	Shm_slot &slot = channel->slots[posted % SHM_RING_SLOTS];
+	memcpy(slot.request, request.c_str(), request.size() + 1);
+	slot.request_len = request.size();
+	if(data_out) {
+		memcpy(slot.data, data_out, FS_BLOCKSIZE);
+	}
+	channel->posted.store(posted + 1);
+	if(channel->server_sleeping.load()) {
+		shm_wake(channel->posted);
+	}
+
+	if(!wait_answer(region, *channel, posted + 1) || slot.status != SHM_OK) {
+		return -1;
+	}
+	if(data_in) {
+		memcpy(data_in, slot.data, FS_BLOCKSIZE);
+	}
+	return 0;
+}
+
+/*
+	Sends one request over a connection from server and checks the response.
+	Arguments as for fs_common
+	Returns as recv_response, and -2 if the server cannot be reached
+*/
+static int pool_common(Connection_pool &server, const std::string &request,
+                       const void *data_out, void *data_in)
+{
+	std::string message(request.c_str(), request.size() + 1);
+	if(data_out) {
+		message.append((const char *)data_out, FS_BLOCKSIZE);
+	}
+
+	//The server echoes the request (including NULL) on success
+	std::vector<char> expected(request.c_str(), request.c_str() + request.size() + 1);
+
+	for(int attempt = 0; attempt < 2; ++attempt) {
+		bool reused = false;
+		int fd = server.acquire(reused);
+		if(fd == -1) {
+			return -2;
+		}
+		if(!send_all(fd, message.data(), message.size())) {
+			server.release(fd, false);
+			//A pooled connection may have been dropped by the server since
+			//it was last checked; retry once on a fresh connection
+			if(reused) {
+				continue;
+			}
+			return -2;
+		}
+		int status = recv_response(fd, expected, data_in);
+		server.release(fd, status != -2);
+		return status;
+	}
+	return -2;
+}
+
+/*
+	Sends one request and checks the server's response.
+	request: request string without the terminating NULL
+	data_out: block to send after the request (FS_WRITEBLOCK) or nullptr
+	data_in: where to put the block following the response (FS_READBLOCK)
+		 or nullptr
+	Returns 0 on success, -1 on failure
+*/
+static int fs_common(const std::string &request, const void *data_out, void *data_in)
+{
+	int shm_status = shm_common(request, data_out, data_in);
+	if(shm_status != -2) {
+		return shm_status;
+	}
+	return pool_common(pool, request, data_out, data_in) == 0 ? 0 : -1;
+}
+
+//Sends an uncached read to the read replica if there is one, and to the
+//server if the replica is behind or cannot be reached
+static int read_common(const std::string &request, void *data_in)
+{
+	int status = pool_common(replica_pool, request, nullptr, data_in);
+	if(status == 0 || status == -1) {
+		return status;
+	}
+	return fs_common(request, nullptr, data_in);
+}
+
+/*
+	Pipelined requests for the asynchronous interface.
+	Each channel is one connection with a reader thread that matches the
+	server's in-order responses to the requests waiting on it.
+*/
+class Async_channel
+{
+	public:
+
+		Async_channel(const struct sockaddr_in &server) : addr(server) {}
+
+		~Async_channel()
+		{
+			std::unique_lock<std::mutex> lck(pending_lock);
+			closing = true;
+			if(fd != -1) {
+				shutdown(fd, SHUT_RDWR);
+			}
+			ready.notify_all();
+			lck.unlock();
+			if(reader.joinable()) {
+				reader.join();
+			}
+			if(fd != -1) {
+				close(fd);
+			}
+		}
+
+		/*	Queues message on this channel and sends it.
+			expected: the response the server echoes on success
+			data_in: where to put a read's block, or nullptr
+			done: called with 0 or -1 once the response arrives			*/
+		void submit(const std::string &message, std::vector<char> expected,
+			    void *data_in, fs_callback done)
+		{
+			std::lock_guard<std::mutex> send_lck(send_lock);
+			while(true) {
+				std::unique_lock<std::mutex> lck(pending_lock);
+				//Don't pipeline onto a connection the server dropped while idle
+				if(!broken && pending.empty() && !still_open(fd)) {
+					broken = true;
+					shutdown(fd, SHUT_RDWR);
+					//Lets the idle reader exit so restart() can join it
+					ready.notify_all();
+				}
+				if(!broken) {
+					pending.push_back({std::move(expected), data_in, std::move(done)});
+					ready.notify_one();
+					break;
+				}
+				lck.unlock();
+				if(!restart()) {
+					done(-1);
+					return;
+				}
+			}
+			//The reader fails this request (and all after it) if the send breaks
+			if(!send_all(fd, message.data(), message.size())) {
+				shutdown(fd, SHUT_RDWR);
+			}
+		}
+
+	private:
+
+		struct Pending {
+			std::vector<char> expected;
+			void *data_in;
+			fs_callback done;
+		};
+
+		struct sockaddr_in addr;
+		std::mutex send_lock;		//orders requests on the connection
+		std::mutex pending_lock;	//protects everything below
+		std::condition_variable ready;
+		std::deque<Pending> pending;
+		int fd = -1;
+		bool broken = true;		//no usable connection
+		unsigned int generation = 0;	//connections made so far
+		bool closing = false;
+		std::thread reader;
+
+		//Replaces a broken connection, called with send_lock held
+		bool restart()
+		{
+			if(reader.joinable()) {
+				//A callback may submit from the reader thread itself
+				if(reader.get_id() == std::this_thread::get_id()) {
+					reader.detach();
+				}
+				else {
+					reader.join();
+				}
+			}
+			if(fd != -1) {
+				close(fd);
+			}
+			fd = connect_server(addr);
+			if(fd == -1) {
+				return false;
+			}
+			std::lock_guard<std::mutex> lck(pending_lock);
+			broken = false;
+			//A reader detached above sees this and exits rather than
+			//read the new connection alongside its own reader
+			generation++;
+			reader = std::thread(&Async_channel::read_responses, this, fd, generation);
+			return true;
+		}
+
+		//Completes pending requests in order until the connection breaks
+		//or is replaced
+		void read_responses(int conn, unsigned int connection)
+		{
+			while(true) {
+				std::unique_lock<std::mutex> lck(pending_lock);
+				ready.wait(lck, [this, connection] {
+					return !pending.empty() || closing || broken || generation != connection;
+				});
+				if(pending.empty() || generation != connection) {
+					return;
+				}
+				Pending &front = pending.front();
+				lck.unlock();
+
+				//Only this thread pops, so front stays valid
+				int status = recv_response(conn, front.expected, front.data_in);
+
+				lck.lock();
+				if(status == -2) {
+					//Everything sent on this connection is lost
+					broken = true;
+					shutdown(conn, SHUT_RDWR);
+					std::deque<Pending> failed;
+					failed.swap(pending);
+					lck.unlock();
+					for(Pending &p : failed) {
+						p.done(-1);
+					}
+					return;
+				}
+				Pending done = std::move(pending.front());
+				pending.pop_front();
+				lck.unlock();
+				done.done(status == 0 ? 0 : -1);
+			}
+		}
+};
+
+/*
+	The asynchronous interface's connections, created on first use.
+	Requests for the same pathname always use the same channel, so the
+	server sees them in the order they were issued.
+*/
+class Async_pool
+{
+	public:
+
+		void submit(const char *pathname, const std::string &message,
+			    std::vector<char> expected, void *data_in, fs_callback done)
+		{
+			Async_channel *channel = pick(pathname);
+			if(!channel) {
+				done(-1);
+				return;
+			}
+			channel->submit(message, std::move(expected), data_in, std::move(done));
+		}
+
+	private:
+
+		std::mutex lock;
+		std::vector<std::unique_ptr<Async_channel>> channels;
+
+		Async_channel *pick(const char *pathname)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			if(channels.empty()) {
+				struct sockaddr_in addr;
+				if(!pool.server_address(addr)) {
+					return nullptr;
+				}
+				for(unsigned int i = 0; i < pool.size(); ++i) {
+					channels.emplace_back(new Async_channel(addr));
+				}
+			}
+			return channels[std::hash<std::string>()(pathname) % channels.size()].get();
+		}
+};
+
+static Async_pool async_pool;
+
+//Receives a message up to its NULL, at most limit bytes, false on failure
+static bool recv_message(int fd, std::string &out, size_t limit)
+{
+	out.clear();
+	char c;
+	while(out.size() < limit) {
+		if(recv(fd, &c, 1, 0) != 1) {
+			return false;
+		}
+		if(c == '\0') {
+			return true;
+		}
+		out.push_back(c);
+	}
+	return false;
+}
+
+/*
+	Blocks read under the server's leases.  A file's blocks are kept until
+	the server recalls the file, its lease runs out, or room is needed for
+	other blocks (least recently used first).  Recalls arrive on a
+	connection of the cache's own, read by a thread of its own.
+*/
+class Block_cache
+{
+	public:
+
+		typedef std::chrono::steady_clock Clock;
+
+		//What a read that fills the cache started under
+		struct Fill {
+			uint64_t holder;
+			uint64_t recalls;
+			Clock::time_point sent;
+		};
+
+		~Block_cache()
+		{
+			stop();
+		}
+
+		//Becomes a lease holder and caches up to blocks blocks, 0 to stop
+		int start(unsigned int blocks)
+		{
+			std::lock_guard<std::mutex> setup_lck(setup_lock);
+			stop();
+			if(blocks == 0) {
+				return 0;
+			}
+			struct sockaddr_in addr;
+			if(!pool.server_address(addr)) {
+				return -1;
+			}
+			int fd = connect_server(addr);
+			if(fd == -1) {
+				return -1;
+			}
+			std::string reply;
+			unsigned long long id;
+			unsigned int ms;
+			char extra;
+			if(!send_all(fd, LEASE_REQUEST, sizeof(LEASE_REQUEST)) ||
+			   !recv_message(fd, reply, 64) ||
+			   sscanf(reply.c_str(), "FS_LEASES %llu %u%c", &id, &ms, &extra) != 2) {
+				close(fd);
+				return -1;
+			}
+			std::lock_guard<std::mutex> lck(lock);
+			recall_fd = fd;
+			holder = id;
+			lease = std::chrono::milliseconds(ms);
+			capacity = blocks;
+			enabled = true;
+			recaller = std::thread(&Block_cache::take_recalls, this, fd);
+			return 0;
+		}
+
+		//Stops caching and gives up the recall connection
+		void stop()
+		{
+			std::unique_lock<std::mutex> lck(lock);
+			enabled = false;
+			drop_all();
+			if(recall_fd != -1) {
+				shutdown(recall_fd, SHUT_RDWR);
+			}
+			lck.unlock();
+			if(recaller.joinable()) {
+				recaller.join();
+			}
+			if(recall_fd != -1) {
+				close(recall_fd);
+				recall_fd = -1;
+			}
+		}
+
+		//Copies a cached block into buf, false if it is not cached
+		bool lookup(const std::string &key, uint32_t block, void *buf)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			if(!enabled) {
+				return false;
+			}
+			auto file = files.find(key);
+			if(file == files.end()) {
+				return false;
+			}
+			if(file->second.expires <= Clock::now()) {
+				drop_file(file);
+				return false;
+			}
+			auto found = file->second.blocks.find(block);
+			if(found == file->second.blocks.end()) {
+				return false;
+			}
+			memcpy(buf, found->second->data, FS_BLOCKSIZE);
+			lru.splice(lru.begin(), lru, found->second);
+			return true;
+		}
+
+		//Starts a read that will fill the cache, false if it is off
+		bool begin_fill(Fill &fill)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			fill = {holder, recalls, Clock::now()};
+			return enabled;
+		}
+
+		//True while the cache still holds leases as fill.holder
+		bool holding(const Fill &fill)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			return enabled && holder == fill.holder;
+		}
+
+		/*	Keeps a block read under a lease, unless a recall (which may
+			be for this very file) came in since the read was sent.
+			The lease runs from when the read was sent, so it ends no
+			later than the server's.						*/
+		void finish_fill(const Fill &fill, const std::string &key, uint32_t block, const void *buf)
+		{
+			std::lock_guard<std::mutex> lck(lock);
+			if(!enabled || holder != fill.holder || recalls != fill.recalls) {
+				return;
+			}
+			Cached_file &file = files[key];
+			file.expires = std::max(file.expires, fill.sent + lease);
+			auto found = file.blocks.find(block);
+			if(found != file.blocks.end()) {
+				lru.splice(lru.begin(), lru, found->second);
+			}
+			else {
+				lru.emplace_front();
+				lru.front().key = key;
+				lru.front().block = block;
+				file.blocks[block] = lru.begin();
+			}
+			memcpy(lru.front().data, buf, FS_BLOCKSIZE);
+			while(lru.size() > capacity) {
+				Cached_block &victim = lru.back();
+				auto owner = files.find(victim.key);
+				owner->second.blocks.erase(victim.block);
+				if(owner->second.blocks.empty()) {
+					files.erase(owner);
+				}
+				lru.pop_back();
+			}
+		}
+
+	private:
+
+		struct Cached_block {
+			std::string key;
+			uint32_t block;
+			char data[FS_BLOCKSIZE];
+		};
+
+		struct Cached_file {
+			Clock::time_point expires;
+			std::unordered_map<uint32_t, std::list<Cached_block>::iterator> blocks;
+		};
+
+		std::mutex setup_lock;		//orders start() calls
+		std::mutex lock;		//protects everything below
+		bool enabled = false;
+		int recall_fd = -1;
+		uint64_t holder = 0;
+		uint64_t recalls = 0;		//recalls taken so far
+		Clock::duration lease;
+		unsigned int capacity = 0;
+		std::unordered_map<std::string, Cached_file> files;	//by "<username> <pathname>"
+		std::list<Cached_block> lru;	//most recently used first
+		std::thread recaller;
+
+		void drop_file(std::unordered_map<std::string, Cached_file>::iterator file)
+		{
+			for(auto &cached : file->second.blocks) {
+				lru.erase(cached.second);
+			}
+			files.erase(file);
+		}
+
+		void drop_all()
+		{
+			files.clear();
+			lru.clear();
+			recalls++;
+		}
+
+		//Drops each file the server recalls, then tells it so, until the
+		//connection fails; the cache is off from then on
+		void take_recalls(int fd)
+		{
+			std::string recall;
+			while(recv_message(fd, recall, 1024)) {
+				unsigned long long sequence;
+				int key_start = 0;
+				if(sscanf(recall.c_str(), "FS_RECALL %llu %n", &sequence, &key_start) != 1 || key_start == 0) {
+					break;
+				}
+				{
+					std::lock_guard<std::mutex> lck(lock);
+					recalls++;
+					auto file = files.find(recall.substr(key_start));
+					if(file != files.end()) {
+						drop_file(file);
+					}
+				}
+				std::string answer = "FS_RECALLED " + std::to_string(sequence);
+				if(!send_all(fd, answer.c_str(), answer.size() + 1)) {
+					break;
+				}
+			}
+			std::lock_guard<std::mutex> lck(lock);
+			enabled = false;
+			drop_all();
+		}
+};
+
+static Block_cache block_cache;
+
+//Builds the request string (without NULL) for each request type
+static std::string readblock_request(const char *username, const char *pathname,
+				     unsigned int offset)
+{
+	return std::string("FS_READBLOCK ") + username + " " + pathname + " " +
+	       std::to_string(offset);
+}
+
+static std::string leaseblock_request(const char *username, const char *pathname,
+				     unsigned int offset, uint64_t holder)
+{
+	return std::string("FS_LEASEBLOCK ") + username + " " + pathname + " " +
+	       std::to_string(offset) + " " + std::to_string(holder);
+}
+
+static std::string writeblock_request(const char *username, const char *pathname,
+				      unsigned int offset)
+{
+	return std::string("FS_WRITEBLOCK ") + username + " " + pathname + " " +
+	       std::to_string(offset);
+}
+
+static std::string create_request(const char *username, const char *pathname, char type)
+{
+	return std::string("FS_CREATE ") + username + " " + pathname + " " + type;
+}
+
+static std::string delete_request(const char *username, const char *pathname)
+{
+	return std::string("FS_DELETE ") + username + " " + pathname;
+}
+
+static std::string delete_tree_request(const char *username, const char *pathname)
+{
+	return std::string("FS_DELETE_TREE ") + username + " " + pathname;
+}
+
+static std::string copy_request(const char *username, const char *pathname,
+				const char *dest_pathname)
+{
+	return std::string("FS_COPY ") + username + " " + pathname + " " + dest_pathname;
+}
+
+//Queues request (plus a write's data) on the asynchronous connections
+static void async_common(const char *pathname, const std::string &request,
+			 const void *data_out, void *data_in, fs_callback done)
+{
+	std::string message(request.c_str(), request.size() + 1);
+	if(data_out) {
+		message.append((const char *)data_out, FS_BLOCKSIZE);
+	}
+	std::vector<char> expected(request.c_str(), request.c_str() + request.size() + 1);
+	async_pool.submit(pathname, message, std::move(expected), data_in, std::move(done));
+}
+
+//Adapts the callback interface to a future
+static std::future<int> async_future(std::function<void(fs_callback)> start)
+{
+	auto promise = std::make_shared<std::promise<int>>();
+	std::future<int> result = promise->get_future();
+	start([promise](int status) { promise->set_value(status); });
+	return result;
+}
+
+int fs_clientinit(const char *hostname, uint16_t port)
+{
+	if(pool.init(hostname, port) == -1) {
+		return -1;
+	}
+	//A server without leases leaves the client uncached, not broken
+	const char *env_blocks = getenv("FS_CLIENT_CACHE_BLOCKS");
+	if(env_blocks && atoi(env_blocks) > 0) {
+		block_cache.start(atoi(env_blocks));
+	}
+	return 0;
+}
+
+int fs_clientinit_replica(const char *hostname, uint16_t port)
+{
+	return replica_pool.init(hostname, port);
+}
+
+int fs_clientcache(unsigned int blocks)
+{
+	return block_cache.start(blocks);
+}
+
+int fs_clientinit_shm(const char *name)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+	if(fd == -1) {
+		perror("shm_open");
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(Shm_region)) {
+		close(fd);
+		return -1;
+	}
+	void *mem = mmap(nullptr, sizeof(Shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mem == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	//The server writes the magic last, once the rest is ready
+	Shm_region *region = (Shm_region *) mem;
+	bool ready = memcmp(region->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) == 0;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	Shm_region *unset = nullptr;
+	if(!ready || region->block_size != FS_BLOCKSIZE || region->channels != SHM_CHANNELS ||
+	   !shm_region.compare_exchange_strong(unset, region)) {
+		munmap(mem, sizeof(Shm_region));
+		return -1;
+	}
+	return 0;
+}
+
+int fs_clientpoolsize(unsigned int size)
+{
+	if(size == 0) {
+		return -1;
+	}
+	pool.set_size(size);
+	replica_pool.set_size(size);
+	return 0;
+}
+
+int fs_readblock(const char *username, const char *pathname,
+                 unsigned int offset, void *buf)
+{
+	std::string key = std::string(username) + " " + pathname;
+	if(block_cache.lookup(key, offset, buf)) {
+		return 0;
+	}
+	Block_cache::Fill fill;
+	if(!block_cache.begin_fill(fill)) {
+		return read_common(readblock_request(username, pathname, offset), buf);
+	}
+	if(fs_common(leaseblock_request(username, pathname, offset, fill.holder), nullptr, buf) != 0) {
+		//The server forgets a holder whose connection broke meanwhile
+		if(block_cache.holding(fill)) {
+			return -1;
+		}
+		return read_common(readblock_request(username, pathname, offset), buf);
+	}
+	block_cache.finish_fill(fill, key, offset, buf);
+	return 0;
+}
+
+int fs_writeblock(const char *username, const char *pathname,
+                  unsigned int offset, const void *buf)
+{
+	return fs_common(writeblock_request(username, pathname, offset), buf, nullptr);
+}
+
+int fs_create(const char *username, const char *pathname, char type)
+{
+	return fs_common(create_request(username, pathname, type), nullptr, nullptr);
+}
+
+int fs_delete(const char *username, const char *pathname)
+{
+	return fs_common(delete_request(username, pathname), nullptr, nullptr);
+}
+
+int fs_delete_tree(const char *username, const char *pathname)
+{
+	return fs_common(delete_tree_request(username, pathname), nullptr, nullptr);
+}
+
+int fs_copy(const char *username, const char *pathname, const char *dest_pathname)
+{
+	return fs_common(copy_request(username, pathname, dest_pathname), nullptr, nullptr);
+}
+
+void fs_readblock_async(const char *username, const char *pathname,
+                        unsigned int offset, void *buf, fs_callback done)
+{
+	async_common(pathname, readblock_request(username, pathname, offset),
+		     nullptr, buf, std::move(done));
+}
+
+void fs_writeblock_async(const char *username, const char *pathname,
+                         unsigned int offset, const void *buf, fs_callback done)
+{
+	async_common(pathname, writeblock_request(username, pathname, offset),
+		     buf, nullptr, std::move(done));
+}
+
+void fs_create_async(const char *username, const char *pathname, char type,
+                     fs_callback done)
+{
+	async_common(pathname, create_request(username, pathname, type),
+		     nullptr, nullptr, std::move(done));
+}
+
+void fs_delete_async(const char *username, const char *pathname, fs_callback done)
+{
+	async_common(pathname, delete_request(username, pathname),
+		     nullptr, nullptr, std::move(done));
+}
+
+std::future<int> fs_readblock_async(const char *username, const char *pathname,
+                                    unsigned int offset, void *buf)
+{
+	return async_future([=](fs_callback done) {
+		fs_readblock_async(username, pathname, offset, buf, std::move(done));
+	});
+}
+
+std::future<int> fs_writeblock_async(const char *username, const char *pathname,
+                                     unsigned int offset, const void *buf)
+{
+	return async_future([=](fs_callback done) {
+		fs_writeblock_async(username, pathname, offset, buf, std::move(done));
+	});
+}
+
+std::future<int> fs_create_async(const char *username, const char *pathname, char type)
+{
+	return async_future([=](fs_callback done) {
+		fs_create_async(username, pathname, type, std::move(done));
+	});
+}
+
+std::future<int> fs_delete_async(const char *username, const char *pathname)
+{
+	return async_future([=](fs_callback done) {
+		fs_delete_async(username, pathname, std::move(done));
+	});
+}
@@ -10,6 +10,9 @@
 #include <sys/types.h>
 #include <netinet/in.h>
 
+#include <functional>
+#include <future>
+
 #include "fs_param.h"
 
 /*
@@ -20,6 +23,55 @@
  */
 extern int fs_clientinit(const char *hostname, uint16_t port);
 
+/*
+ * Also use the shared memory transport of a file server on this host that
+ * was started with FS_SHM=name.  Each thread claims one of the server's
+ * channels with its first synchronous request and keeps it until the
+ * thread exits; threads that find every channel taken, and the
+ * asynchronous functions, use the connections of fs_clientinit instead.
+ *
+ * fs_clientinit_shm returns 0 on success, -1 on failure.
+ */
+extern int fs_clientinit_shm(const char *name);
+
+/*
+ * Also send reads to a read replica, a follower server (FS_FOLLOW) at
+ * (hostname, port).  fs_readblock asks the replica first and goes to the
+ * server of fs_clientinit when the replica answers that it is too far
+ * behind, or cannot be reached.  Reads through the block cache of
+ * fs_clientcache, the asynchronous functions and every other request go to
+ * the server of fs_clientinit only.
+ *
+ * fs_clientinit_replica returns 0 on success, -1 on failure (for instance
+ * if a replica was already set).
+ */
+extern int fs_clientinit_replica(const char *hostname, uint16_t port);
+
+/*
+ * Set the maximum number of persistent connections the client library keeps
+ * open to the file server.  Requests from different threads share these
+ * connections; a thread waits for one to become free when all are in use.
+ * The default is 8, or the value of the FS_CLIENT_POOL_SIZE environment
+ * variable when fs_clientinit is called.
+ *
+ * fs_clientpoolsize returns 0 on success, -1 on failure (size is 0).
+ */
+extern int fs_clientpoolsize(unsigned int size);
+
+/*
+ * Cache up to blocks blocks read by fs_readblock in this process, so
+ * reading them again costs no request.  The server leases each file read
+ * into the cache for a while (FS_LEASE_MS on the server) and recalls the
+ * lease before anyone writes or deletes the file, so a cached block is
+ * never older than the file.  A size of 0 turns the cache off.  When
+ * fs_clientinit is called, FS_CLIENT_CACHE_BLOCKS in the environment turns
+ * the cache on with that size.
+ *
+ * fs_clientcache returns 0 on success, -1 on failure (fs_clientinit has not
+ * succeeded, or the server does not grant leases).
+ */
+extern int fs_clientcache(unsigned int blocks);
+
 /*
  * Read a block of data from the file specified by pathname.  offset specifies
  * the block to be read.  buf specifies where to store the data read from the
@@ -85,4 +137,84 @@ extern int fs_create(const char *username, const char *pathname, char type);
  */
 extern int fs_delete(const char *username, const char *pathname);
 
+/*
+ * Delete the existing file or directory "pathname" together with everything
+ * below it, in a single request.
+ *
+ * fs_delete_tree returns 0 on success, -1 on failure.  Possible failures
+ * include:
+ *     pathname is invalid
+ *     pathname is not owned by username
+ *     pathname is in a directory not owned by username
+ *     pathname does not exist
+ *     username is invalid
+ *
+ * fs_delete_tree is thread safe.
+ */
+extern int fs_delete_tree(const char *username, const char *pathname);
+
+/*
+ * Create a new file "dest_pathname" with the same contents as the existing
+ * file "pathname".  The copy is made on the server without transferring
+ * the file's data, and takes no new disk blocks until one of the two files
+ * is written.
+ *
+ * fs_copy returns 0 on success, -1 on failure.  Possible failures include:
+ *     pathname or dest_pathname is invalid
+ *     pathname does not exist, is not a file, or is not owned by username
+ *     dest_pathname is in a directory not owned by username
+ *     dest_pathname already exists
+ *     the disk or directory containing dest_pathname is out of space
+ *     username is invalid
+ *
+ * fs_copy is thread safe.
+ */
+extern int fs_copy(const char *username, const char *pathname,
+                   const char *dest_pathname);
+
+/*
+ * Asynchronous interface.
+ *
+ * Each function below starts the same request as its synchronous
+ * counterpart and returns without waiting for the server.  Requests are
+ * pipelined over a set of shared connections (as many as the pool size when
+ * the first asynchronous request is made), so one thread can have many
+ * requests in flight.  Requests on the same pathname are carried out in the
+ * order they were issued.
+ *
+ * The result (0 on success, -1 on failure, as above) is delivered either
+ * through the returned future or by calling done.  done runs on a client
+ * library thread and should not block for long.  For fs_readblock_async,
+ * buf must stay valid until the request completes; fs_writeblock_async
+ * copies buf before returning.
+ *
+ * All of these functions are thread safe.
+ */
+typedef std::function<void(int status)> fs_callback;
+
+extern std::future<int> fs_readblock_async(const char *username,
+                                           const char *pathname,
+                                           unsigned int offset, void *buf);
+extern void fs_readblock_async(const char *username, const char *pathname,
+                               unsigned int offset, void *buf,
+                               fs_callback done);
+
+extern std::future<int> fs_writeblock_async(const char *username,
+                                            const char *pathname,
+                                            unsigned int offset,
+                                            const void *buf);
+extern void fs_writeblock_async(const char *username, const char *pathname,
+                                unsigned int offset, const void *buf,
+                                fs_callback done);
+
+extern std::future<int> fs_create_async(const char *username,
+                                        const char *pathname, char type);
+extern void fs_create_async(const char *username, const char *pathname,
+                            char type, fs_callback done);
+
+extern std::future<int> fs_delete_async(const char *username,
+                                        const char *pathname);
+extern void fs_delete_async(const char *username, const char *pathname,
+                            fs_callback done);
+
 #endif /* _FS_CLIENT_H_ */
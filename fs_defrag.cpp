@@ -0,0 +1,236 @@
+#include "fs_server.h"
+#include "fs_filesystem.h"
+#include "fs_defrag.h"
+#include "fs_device.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <queue>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+extern std::unordered_map<int, std::mutex> inode_locks;
+extern std::atomic<int> active_requests;
+
+//A file or directory still to be visited in the current pass
+struct Defrag_item {
+	std::string owner;
+	Path_list path;
+};
+
+//Counts gathered over one pass of the defragmenter
+struct Defrag_stats {
+	uint64_t blocks = 0;		//file data blocks
+	uint64_t files = 0;		//files with at least one block
+	uint64_t extents_before = 0;	//contiguous runs before the pass
+	uint64_t extents_after = 0;	//contiguous runs after the pass
+	uint64_t files_moved = 0;
+	uint64_t dirs_compacted = 0;
+};
+
+//Number of step intervals to wait between passes
+static const unsigned int PASS_PAUSE_STEPS = 500;
+
+//Most step intervals a step waits for the server to go idle, so it still
+//gets through under sustained load
+static const unsigned int MAX_IDLE_WAIT_STEPS = 10;
+
+static unsigned int defrag_step_ms;
+
+//Waits one step interval, then more until the server is idle or
+//MAX_IDLE_WAIT_STEPS have gone by
+static void defrag_throttle() {
+	std::chrono::milliseconds step(defrag_step_ms);
+	unsigned int waited = 0;
+	do {
+		std::this_thread::sleep_for(step);
+	} while(active_requests.load() > 0 && ++waited < MAX_IDLE_WAIT_STEPS);
+}
+
+//Number of contiguous runs in blocks[0..count), not counting holes
+static uint32_t count_extents(const uint32_t blocks[], uint32_t count) {
+	uint32_t extents = 0;
+	uint32_t prev = FS_HOLE;
+	for(uint32_t i = 0; i < count; ++i) {
+		if(blocks[i] == FS_HOLE) {
+			continue;
+		}
+		if(prev == FS_HOLE || blocks[i] != prev + 1) {
+			extents++;
+		}
+		prev = blocks[i];
+	}
+	return extents;
+}
+
+//Number of entries in blocks[0..count) that have a disk block
+static uint32_t count_data_blocks(const uint32_t blocks[], uint32_t count) {
+	uint32_t data_blocks = 0;
+	for(uint32_t i = 0; i < count; ++i) {
+		if(blocks[i] != FS_HOLE) {
+			data_blocks++;
+		}
+	}
+	return data_blocks;
+}
+
+/*
+	Moves a file's data blocks into one contiguous run; holes stay holes.
+	The caller holds the file's inode lock, so the copy and the inode
+	rewrite are seen as one change by every other request.
+*/
+static bool relocate_file(fs_inode &file, uint32_t file_num) {
+	uint32_t start;
+	if(!take_free_run(count_data_blocks(file.blocks, file.size), start)) {
+		return false;
+	}
+	char data[FS_BLOCKSIZE];
+	Block_list freed;
+	uint32_t next = start;
+	for(uint32_t i = 0; i < file.size; ++i) {
+		if(file.blocks[i] == FS_HOLE) {
+			continue;
+		}
+		freed.push_back(file.blocks[i]);
+		dev_readblock(file.blocks[i], (void*)data);
+		dev_writeblock(next, (void*)data);
+		file.blocks[i] = next++;
+	}
+	Dev_write inode_write = {file_num, &file};
+	dev_commit(&inode_write, 1);
+	free_block_batch(freed);
+	return true;
+}
+
+/*
+	Packs a directory's entries into as few blocks as possible, written to
+	one contiguous run.  The caller holds the directory's inode lock.
+	Returns false if the directory was already compact or no run was free.
+*/
+static bool compact_dir(fs_inode &dir, uint32_t dir_num) {
+	std::vector<fs_direntry> entries;
+	fs_direntry dir_block[FS_DIRENTRIES];
+	for(uint32_t i = 0; i < dir.size; ++i) {
+		dev_readblock(dir.blocks[i], (void*)dir_block);
+		for(unsigned int j = 0; j < FS_DIRENTRIES; ++j) {
+			if(dir_block[j].inode_block != 0) {
+				entries.push_back(dir_block[j]);
+			}
+		}
+	}
+
+	uint32_t needed = (entries.size() + FS_DIRENTRIES - 1) / FS_DIRENTRIES;
+	if(needed == 0 || (needed == dir.size && count_extents(dir.blocks, dir.size) == 1)) {
+		return false;
+	}
+	uint32_t start;
+	if(!take_free_run(needed, start)) {
+		return false;
+	}
+
+	//The packed blocks and the inode pointing at them are one change
+	Block_list freed(dir.blocks, dir.blocks + dir.size);
+	entries.resize(needed * FS_DIRENTRIES);
+	std::vector<Dev_write> writes;
+	for(uint32_t i = 0; i < needed; ++i) {
+		dir.blocks[i] = start + i;
+		writes.push_back({start + i, &entries[i * FS_DIRENTRIES]});
+	}
+	dir.size = needed;
+	writes.push_back({dir_num, &dir});
+	dev_commit(writes.data(), writes.size());
+	free_block_batch(freed);
+	return true;
+}
+
+/*
+	Defragments one file or directory and queues a directory's children.
+	The path is traversed like a request's, so the usual hand-over-hand
+	inode locking keeps the defragmenter out of everyone else's way.
+*/
+static void defrag_item(const Defrag_item &item, std::queue<Defrag_item> &items, Defrag_stats &stats) {
+	Lock_RAII lck(&inode_locks[0]);
+	fs_inode node;
+	uint32_t node_num = pathTraversal(item.path, node, "FS_READBLOCK", item.owner, lck);
+	if(node_num == fs_disksize) {
+		return;		//deleted since it was queued
+	}
+
+	if(node.type == FS_INLINE) {
+		return;			//nothing outside the inode to move
+	}
+	if(node.type == 'f') {
+		if(count_data_blocks(node.blocks, node.size) == 0) {
+			return;
+		}
+		uint32_t extents = count_extents(node.blocks, node.size);
+		stats.files++;
+		stats.blocks += count_data_blocks(node.blocks, node.size);
+		stats.extents_before += extents;
+		//Moving a file's own copy of shared blocks would only use more space
+		if(extents > 1 && !blocks_shared(node.blocks, node.size) && relocate_file(node, node_num)) {
+			stats.files_moved++;
+			extents = 1;
+		}
+		stats.extents_after += extents;
+		return;
+	}
+
+	if(compact_dir(node, node_num)) {
+		stats.dirs_compacted++;
+	}
+
+	fs_direntry dir_block[FS_DIRENTRIES];
+	for(uint32_t i = 0; i < node.size; ++i) {
+		dev_readblock(node.blocks[i], (void*)dir_block);
+		for(unsigned int j = 0; j < FS_DIRENTRIES; ++j) {
+			if(dir_block[j].inode_block == 0) {
+				continue;
+			}
+			Defrag_item child = {item.owner, item.path};
+			child.path.push_back(dir_block[j].name);
+			//Everything below a top-level entry belongs to its owner
+			if(item.path.empty()) {
+				fs_inode child_node;
+				Lock_RAII child_lock(&inode_locks[dir_block[j].inode_block]);
+				dev_readblock(dir_block[j].inode_block, (void*)&child_node);
+				child.owner = child_node.owner;
+			}
+			items.push(child);
+		}
+	}
+}
+
+//Runs passes over the whole file system forever
+static void defrag_loop() {
+	while(true) {
+		Defrag_stats stats;
+		std::queue<Defrag_item> items;
+		items.push(Defrag_item());
+		while(!items.empty()) {
+			defrag_throttle();
+			defrag_item(items.front(), items, stats);
+			items.pop();
+		}
+
+		//0 when every file is one contiguous run, 1 when no two blocks are adjacent
+		uint64_t gaps = stats.blocks - stats.files;
+		double before = gaps ? (double)(stats.extents_before - stats.files) / gaps : 0;
+		double after = gaps ? (double)(stats.extents_after - stats.files) / gaps : 0;
+		{
+			Lock_RAII cout_mutex(&cout_lock);
+			std::cout << "defrag: fragmentation " << before << " -> " << after
+				  << " (" << stats.files_moved << " files moved, "
+				  << stats.dirs_compacted << " directories compacted)" << std::endl;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(defrag_step_ms) * PASS_PAUSE_STEPS);
+	}
+}
+
+void start_defrag(unsigned int step_ms) {
+	defrag_step_ms = step_ms;
+	std::thread(defrag_loop).detach();
+}
@@ -0,0 +1,22 @@
+/*
+ * fs_defrag.h
+ *
+ * Background defragmenter for the file server.
+ */
+
+#ifndef _FS_DEFRAG_H_
+#define _FS_DEFRAG_H_
+
+/*
+ * Starts the defragmenter thread.  It repeatedly walks the file system,
+ * moving each file's data blocks into one contiguous run and packing each
+ * directory's entries into as few contiguous direntry blocks as possible.
+ * Each step waits step_ms, and then more until no requests are being
+ * served, so foreground requests are slowed down little; under sustained
+ * load it goes ahead after 10 step intervals.  After every pass the
+ * fragmentation of the file system is printed and the defragmenter rests
+ * for 500 step intervals.
+ */
+void start_defrag(unsigned int step_ms);
+
+#endif /* _FS_DEFRAG_H_ */
@@ -0,0 +1,186 @@
+#include "fs_server.h"
+#include "fs_device.h"
+#include "fs_wal.h"
+#include "fs_phase.h"
+#include "fs_replica.h"
+#include "fs_iosched.h"
+
+#include <fcntl.h>		// open()
+#include <stdio.h>		// perror(), fprintf()
+#include <unistd.h>		// pread(), pwrite()
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+uint32_t fs_disksize = FS_DISKSIZE;
+
+//Images being served, in stripe set order; empty for the disk of
+//libfs_server.o.  Each is read and written with its own pread()/pwrite()
+//calls, so requests for blocks on different images go on in parallel.
+static std::vector<int> image_fds;
+static uint32_t stripe_blocks = 1;
+
+//One I/O queue per image once dev_schedule_io is called, else empty
+static std::vector<std::unique_ptr<Io_queue>> io_queues;
+
+//Opens one image and reads its superblock; returns the fd, or -1
+static int open_member(const std::string &path, Dev_superblock &super) {
+	int fd = open(path.c_str(), O_RDWR);
+	if(fd == -1) {
+		perror(path.c_str());
+		return -1;
+	}
+	if(pread(fd, &super, sizeof(super), 0) != sizeof(super) ||
+	   memcmp(super.magic, DEV_IMAGE_MAGIC, sizeof(super.magic)) != 0) {
+		fprintf(stderr, "%s: not a disk image\n", path.c_str());
+		close(fd);
+		return -1;
+	}
+	if(super.block_size != FS_BLOCKSIZE) {
+		fprintf(stderr, "%s: formatted with %u byte blocks, this server uses %u\n",
+		        path.c_str(), super.block_size, FS_BLOCKSIZE);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool dev_open_image(const char *path) {
+	std::vector<std::string> paths;
+	std::string list(path);
+	for(size_t start = 0, end; start <= list.size(); start = end + 1) {
+		end = std::min(list.find(',', start), list.size());
+		paths.push_back(list.substr(start, end - start));
+	}
+
+	std::vector<int> fds(paths.size(), -1);
+	Dev_superblock first;
+	for(size_t i = 0; i < paths.size(); ++i) {
+		Dev_superblock super;
+		int fd = open_member(paths[i], super);
+		if(fd == -1) {
+			break;
+		}
+		if(i == 0) {
+			first = super;
+		}
+		//A lone image may be any image made by fs_mkfs, a member must
+		//belong to the same set as the others
+		uint32_t members = super.members ? super.members : 1;
+		const char *problem = nullptr;
+		if(members != paths.size()) {
+			problem = members == 1 ? "not part of a stripe set" : "one image of a bigger or smaller stripe set";
+		}
+		else if(super.set_id != first.set_id || super.disk_blocks != first.disk_blocks ||
+			super.stripe_blocks != first.stripe_blocks) {
+			problem = "from a different stripe set";
+		}
+		else if(members > 1 && (super.stripe_blocks == 0 || super.member >= members || fds[super.member] != -1)) {
+			problem = "given twice, or damaged";
+		}
+		if(problem) {
+			fprintf(stderr, "%s: %s\n", paths[i].c_str(), problem);
+			close(fd);
+			break;
+		}
+		fds[members > 1 ? super.member : 0] = fd;
+	}
+	for(int fd : fds) {
+		if(fd == -1) {
+			for(int opened : fds) {
+				if(opened != -1) {
+					close(opened);
+				}
+			}
+			return false;
+		}
+	}
+
+	image_fds = fds;
+	stripe_blocks = fds.size() > 1 ? first.stripe_blocks : 1;
+	fs_disksize = first.disk_blocks;
+	return true;
+}
+
+bool dev_schedule_io(unsigned int deadline_ms, unsigned int depth) {
+	if(image_fds.empty()) {
+		return false;
+	}
+	for(int fd : image_fds) {
+		io_queues.emplace_back(new Io_queue(fd, deadline_ms, depth));
+	}
+	return true;
+}
+
+//Finds the image holding block and the block's offset in it
+static uint32_t image_block(uint32_t block, off_t &offset) {
+	assert(block < fs_disksize);
+	uint32_t member;
+	uint32_t member_block = dev_stripe_block(block, image_fds.size(), stripe_blocks, member);
+	offset = (off_t)(member_block + 1) * FS_BLOCKSIZE;
+	return member;
+}
+
+void dev_raw_readblock(uint32_t block, void *buf) {
+	if(image_fds.empty()) {
+		disk_readblock(block, buf);
+		return;
+	}
+	off_t offset;
+	uint32_t member = image_block(block, offset);
+	if(!io_queues.empty()) {
+		io_queues[member]->transfer(offset, buf, false);
+		return;
+	}
+	ssize_t done = pread(image_fds[member], buf, FS_BLOCKSIZE, offset);
+	assert(done == FS_BLOCKSIZE);
+	(void)done;
+}
+
+void dev_raw_writeblock(uint32_t block, const void *buf) {
+	if(image_fds.empty()) {
+		disk_writeblock(block, buf);
+		return;
+	}
+	off_t offset;
+	uint32_t member = image_block(block, offset);
+	if(!io_queues.empty()) {
+		io_queues[member]->transfer(offset, (void *)buf, true);
+		return;
+	}
+	ssize_t done = pwrite(image_fds[member], buf, FS_BLOCKSIZE, offset);
+	assert(done == FS_BLOCKSIZE);
+	(void)done;
+}
+
+void dev_readblock(uint32_t block, void *buf) {
+	Phase_RAII phase("disk read");
+	//The log holds the newest copy of metadata not yet checkpointed
+	if(!wal_readblock(block, buf)) {
+		dev_raw_readblock(block, buf);
+	}
+}
+
+void dev_writeblock(uint32_t block, const void *buf) {
+	Phase_RAII phase("disk write");
+	if(!wal_absorb(block, buf)) {
+		dev_raw_writeblock(block, buf);
+	}
+	Dev_write write = {block, buf};
+	replicate_writes(&write, 1);
+}
+
+void dev_commit(const Dev_write writes[], size_t count) {
+	Phase_RAII phase("commit");
+	if(!wal_commit(writes, count)) {
+		for(size_t i = 0; i < count; ++i) {
+			dev_raw_writeblock(writes[i].block, writes[i].data);
+		}
+	}
+	//Only once it is on disk, so a follower copying the disk meanwhile
+	//either read the change or gets it from here
+	replicate_writes(writes, count);
+}
@@ -0,0 +1,120 @@
+/*
+ * fs_device.h
+ *
+ * Block layer between the file system and the disk.  The file system reads
+ * and writes disk blocks only through these functions, so features such as
+ * the write-ahead log and read replicas can sit underneath it.  Every
+ * change written through dev_writeblock and dev_commit is also shipped to
+ * any followers (fs_replica.h).
+ */
+
+#ifndef _FS_DEVICE_H_
+#define _FS_DEVICE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Number of blocks on the disk being served: FS_DISKSIZE for the disk of
+ * libfs_server.o, or the size recorded in a disk image's superblock.
+ * Lookups that find no block return it.
+ */
+extern uint32_t fs_disksize;
+
+/*
+ * A disk image file starts with one block holding its superblock, and
+ * file system block n is stored right after it, at (n + 1) * FS_BLOCKSIZE.
+ *
+ * A disk can also be striped across several images (a stripe set), e.g.
+ * on different volumes: the first stripe_blocks blocks go on image 0, the
+ * next stripe_blocks on image 1, and so on round the images.  Each image
+ * has its own superblock describing the whole set, and holds its share of
+ * the blocks one after another, as dev_stripe_block lays them out.
+ */
+static const char DEV_IMAGE_MAGIC[8] = {'F', 'S', 'I', 'M', 'A', 'G', 'E', '1'};
+
+struct Dev_superblock {
+    char magic[8];                         // DEV_IMAGE_MAGIC
+    uint32_t block_size;                   // FS_BLOCKSIZE it was formatted with
+    uint32_t disk_blocks;                  // file system blocks in the image (the set)
+    uint32_t members;                      // images in the set, 0 for a lone image
+    uint32_t member;                       // index of this image in the set
+    uint32_t stripe_blocks;                // blocks in a row on one image
+    uint32_t set_id;                       // the same in every image of a set
+};
+
+/*
+ * Finds block in a set of members images striped stripe_blocks at a time.
+ * Sets member to the image holding it and returns the block's index among
+ * that image's blocks.
+ */
+inline uint32_t dev_stripe_block(uint32_t block, uint32_t members, uint32_t stripe_blocks, uint32_t &member)
+{
+    uint32_t stripe = block / stripe_blocks;
+    member = stripe % members;
+    return (stripe / members) * stripe_blocks + block % stripe_blocks;
+}
+
+/*
+ * dev_open_image
+ *
+ * Serves the disk image at path instead of the disk of libfs_server.o and
+ * sets fs_disksize from its superblock.  path may also list every image of
+ * a stripe set, separated by commas, in any order.  Must be called before
+ * anything reads the file system.  Returns false (with a message) if an
+ * image cannot be opened, was formatted with another block size, or the
+ * images given do not make up one whole set.
+ */
+bool dev_open_image(const char *path);
+
+/*
+ * dev_schedule_io
+ *
+ * Sends the I/O of every image through an Io_queue (fs_iosched.h), which
+ * sorts waiting block I/Os and merges runs of them into single transfers.
+ * Must be called after dev_open_image and before anything reads the file
+ * system.  Returns false if no image is being served.
+ */
+bool dev_schedule_io(unsigned int deadline_ms, unsigned int depth);
+
+/*
+ * dev_raw_readblock / dev_raw_writeblock
+ *
+ * Read and write a block of the disk or image directly, under the
+ * write-ahead log.  Used by the log itself.
+ */
+void dev_raw_readblock(uint32_t block, void *buf);
+void dev_raw_writeblock(uint32_t block, const void *buf);
+
+/*
+ * One block write in a metadata change
+ */
+struct Dev_write {
+    uint32_t block;                        // disk block to write
+    const void *data;                      // FS_BLOCKSIZE bytes to write there
+};
+
+/*
+ * dev_readblock
+ *
+ * Copies the current contents of disk block "block" into buf.
+ */
+void dev_readblock(uint32_t block, void *buf);
+
+/*
+ * dev_writeblock
+ *
+ * Writes buf to disk block "block".  Used for file data.
+ */
+void dev_writeblock(uint32_t block, const void *buf);
+
+/*
+ * dev_commit
+ *
+ * Writes a metadata change (inodes and direntry blocks) made of several
+ * block writes, applied in order.  With the write-ahead log enabled the
+ * writes reach the disk all together or not at all.
+ */
+void dev_commit(const Dev_write writes[], size_t count);
+
+#endif /* _FS_DEVICE_H_ */
@@ -1,6 +1,9 @@
 #include "fs_client.h"
 #include "fs_server.h"
 #include "fs_filesystem.h"
+#include "fs_device.h"
+#include "fs_phase.h"
+#include "fs_lease.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +13,8 @@
 #include <sstream>
 #include <strstream>
 #include <queue>
+#include <deque>
+#include <algorithm>
 #include <set>
 #include <unordered_map>
 
@@ -17,10 +22,87 @@
 #include <stdio.h>		// printf(), perror()
 #include <stdlib.h>		// atoi()
 #include <cassert>
+#ifdef __SSE2__
+#include <emmintrin.h>		// _mm_or_si128()
+#endif
 
 extern std::queue<uint32_t> free_blocks;
+extern std::vector<bool> free_map;
+extern uint32_t free_count;
+extern std::unordered_map<uint32_t, uint32_t> block_refs;
 extern std::unordered_map<int, std::mutex> inode_locks;
 std::mutex q_lock;
+
+//Blocks take_free_run looks at per hold of q_lock
+static const uint32_t RUN_SCAN_BLOCKS = 4096;
+
+//Takes the next free block off free_blocks, called with q_lock held and
+//free_count > 0
+static uint32_t pop_free_block() {
+	//Skip blocks take_free_run took out of turn
+	while(!free_map[free_blocks.front()]) {
+		free_blocks.pop();
+	}
+	uint32_t block = free_blocks.front();
+	free_blocks.pop();
+	free_map[block] = false;
+	free_count--;
+	return block;
+}
+
+/*
+	Takes count blocks off free_blocks into blocks[], holding q_lock only
+	for that.  Returns false, taking none, if fewer than count are free.
+*/
+static bool take_free_blocks(uint32_t count, uint32_t blocks[]) {
+	Lock_RAII q_mutex(&q_lock);
+	if(free_count < count) {
+		return false;
+	}
+	for(uint32_t i = 0; i < count; ++i) {
+		blocks[i] = pop_free_block();
+	}
+	return true;
+}
+
+bool take_free_run(uint32_t count, uint32_t &start) {
+	uint32_t run = 0;
+	for(uint32_t from = 0; from < fs_disksize; from += RUN_SCAN_BLOCKS) {
+		Lock_RAII q_mutex(&q_lock);
+		uint32_t to = std::min<uint32_t>(fs_disksize, from + RUN_SCAN_BLOCKS);
+		for(uint32_t i = from; i < to; ++i) {
+			run = free_map[i] ? run + 1 : 0;
+			if(run < count) {
+				continue;
+			}
+			//Blocks seen before q_lock was last taken may be gone since
+			uint32_t first = i + 1 - count;
+			uint32_t last_taken = i + 1;
+			for(uint32_t block = first; block <= i; ++block) {
+				if(!free_map[block]) {
+					last_taken = block;
+				}
+			}
+			if(last_taken <= i) {
+				run = i - last_taken;
+				continue;
+			}
+			for(uint32_t block = first; block <= i; ++block) {
+				free_map[block] = false;
+			}
+			free_count -= count;
+			start = first;
+			return true;
+		}
+	}
+	return false;
+}
+
+//Copies a name checked by check_size into a direntry or inode field
+static void copy_name(char dest[], std::string_view name) {
+	memcpy(dest, name.data(), name.size());
+	dest[name.size()] = '\0';
+}
 /*--------------------READ/WRITE/CREATE/DELETE------------------------*/
 
 /*	-Called on FS_READBLOCK requests-
@@ -33,7 +115,68 @@ bool read_block(fs_inode &i_node, char data[], uint32_t path_num, uint32_t block
 	if(block >= i_node.size || i_node.type == 'd') {
 		return false;
 	}
-	disk_readblock(i_node.blocks[block], (void*)data);
+	//Already read with the inode, no disk read needed
+	if(i_node.type == FS_INLINE) {
+		memcpy(data, i_node.blocks, FS_INLINE_BYTES);
+		memset(data + FS_INLINE_BYTES, 0, FS_BLOCKSIZE - FS_INLINE_BYTES);
+		return true;
+	}
+	if(i_node.blocks[block] == FS_HOLE) {
+		memset(data, 0, FS_BLOCKSIZE);
+		return true;
+	}
+	dev_readblock(i_node.blocks[block], (void*)data);
+	return true;
+}
+
+//True if a block holds nothing but zeros
+//Checks 16 bytes per step with SSE2 where available
+static bool is_zero_block(const char data[]) {
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+	for(unsigned int i = 0; i < FS_BLOCKSIZE; i += sizeof(__m128i)) {
+		acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(data + i)));
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xFFFF;
+#else
+	uint64_t acc = 0;
+	for(unsigned int i = 0; i < FS_BLOCKSIZE; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		acc |= word;
+	}
+	return acc == 0;
+#endif
+}
+
+//True if a block can be kept inline: everything past FS_INLINE_BYTES is zero
+static bool fits_inline(const char data[]) {
+	for(unsigned int i = FS_INLINE_BYTES; i < FS_BLOCKSIZE; ++i) {
+		if(data[i] != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//Moves an inline file's block out to a disk block (or a hole if it is all
+//zeros) and commits the inode as an ordinary file
+static bool spill_inline(fs_inode &i_node, uint32_t path_num) {
+	char data[FS_BLOCKSIZE];
+	memcpy(data, i_node.blocks, FS_INLINE_BYTES);
+	memset(data + FS_INLINE_BYTES, 0, FS_BLOCKSIZE - FS_INLINE_BYTES);
+	uint32_t block = FS_HOLE;
+	if(!is_zero_block(data)) {
+		if(!take_free_blocks(1, &block)) {
+			return false;
+		}
+		dev_writeblock(block, (void*)data);
+	}
+	i_node.type = 'f';
+	memset(i_node.blocks, 0, sizeof(i_node.blocks));
+	i_node.blocks[0] = block;
+	Dev_write inode_write = {path_num, &i_node};
+	dev_commit(&inode_write, 1);
 	return true;
 }
 
@@ -50,30 +193,93 @@ bool write_block(fs_inode &i_node, char data[], uint32_t path_num, uint32_t bloc
 	{
 		return false;
 	}
+
+	//No client may go on reading its cached copy once the file changes
+	recall_leases(&path_num, 1);
+
+	//The only block of a file goes in its inode when it fits, so it costs
+	//no block of its own and is read along with the inode
+	if(block == 0 && i_node.size <= 1 && fits_inline(data)) {
+		uint32_t old_block = (i_node.type == 'f' && i_node.size == 1) ? i_node.blocks[0] : FS_HOLE;
+		i_node.type = FS_INLINE;
+		i_node.size = 1;
+		memset(i_node.blocks, 0, sizeof(i_node.blocks));
+		memcpy(i_node.blocks, data, FS_INLINE_BYTES);
+		Dev_write inode_write = {path_num, &i_node};
+		dev_commit(&inode_write, 1);
+		if(old_block != FS_HOLE) {
+			free_block_batch(Block_list(1, old_block, request_arena()));
+		}
+		return true;
+	}
+	if(i_node.type == FS_INLINE) {
+		if(block > i_node.size || !spill_inline(i_node, path_num)) {
+			return false;
+		}
+	}
+
+	bool zero = is_zero_block(data);
 	if(block == i_node.size) {			//is this check correct: >=
 		if(block >= FS_MAXFILEBLOCKS)
 		{
 			return false;
 		}
 
-		Lock_RAII q_mutex(&q_lock);
-		if(free_blocks.empty()) {
+		//A block of zeros is appended as a hole and takes no disk space
+		if(zero) {
+			i_node.blocks[i_node.size++] = FS_HOLE;
+			Dev_write inode_write = {path_num, &i_node};
+			dev_commit(&inode_write, 1);
+			return true;
+		}
+
+		uint32_t free_block;
+		if(!take_free_blocks(1, &free_block)) {
 			return false;
 		}
-		uint32_t free_block = free_blocks.front();
 
-		disk_writeblock(free_block, (void*)data);
+		dev_writeblock(free_block, (void*)data);
 		i_node.blocks[i_node.size++] = free_block;
-		free_blocks.pop();
-		disk_writeblock(path_num, (void*)&i_node);
-
-		
+		Dev_write inode_write = {path_num, &i_node};
+		dev_commit(&inode_write, 1);
 	}
 	else if(block > i_node.size) {
 		return false;
 	}
+	else if(zero) {
+		//Zeroing a block punches a hole; a copy sharing it keeps its data
+		uint32_t old_block = i_node.blocks[block];
+		if(old_block != FS_HOLE) {
+			i_node.blocks[block] = FS_HOLE;
+			Dev_write inode_write = {path_num, &i_node};
+			dev_commit(&inode_write, 1);
+			free_block_batch(Block_list(1, old_block, request_arena()));
+		}
+	}
+	else if(i_node.blocks[block] == FS_HOLE) {
+		//Filling a hole needs a real block
+		uint32_t free_block;
+		if(!take_free_blocks(1, &free_block)) {
+			return false;
+		}
+
+		dev_writeblock(free_block, (void*)data);
+		i_node.blocks[block] = free_block;
+		Dev_write inode_write = {path_num, &i_node};
+		dev_commit(&inode_write, 1);
+	}
 	else {
-		disk_writeblock(i_node.blocks[block], (void*)data);
+		//A block shared with a copy of this file is split off before it changes
+		uint32_t target = take_cow_block(i_node.blocks[block]);
+		if(target == fs_disksize) {
+			return false;
+		}
+		dev_writeblock(target, (void*)data);
+		if(target != i_node.blocks[block]) {
+			i_node.blocks[block] = target;
+			Dev_write inode_write = {path_num, &i_node};
+			dev_commit(&inode_write, 1);
+		}
 	}
 
 	return true;
@@ -85,27 +291,30 @@ bool write_block(fs_inode &i_node, char data[], uint32_t path_num, uint32_t bloc
 	path_num: i_node's block number
 	username: name of the person creating a file
 	final_path: name of the file/directory to be deleted
-	type: 'f' or 'd' for file or directory					*/
-bool create_path(const std::string path, fs_inode &i_node, uint32_t path_num, const std::string &username, char type) {
-	Lock_RAII q_mutex(&q_lock);
-	if(free_blocks.empty()) {
-		return false;
-	}
-	uint32_t free_block = free_blocks.front();
+	type: 'f' or 'd' for file or directory
+	source: inode whose blocks the new file starts with, or nullptr	*/
+bool create_path(std::string_view path, fs_inode &i_node, uint32_t path_num, std::string_view username, char type, const fs_inode *source) {
+	//The caller holds i_node's lock, which is all the scan needs; the
+	//allocator is only locked to take the blocks at the end
 
 	//Checks to see if a spot exists
 	fs_direntry dir_block[FS_DIRENTRIES];
 
 	//Creates inode for new file/directory
 	fs_inode new_node;
-	strcpy(new_node.owner, username.c_str());
+	copy_name(new_node.owner, username);
 	new_node.size = 0;
 	new_node.type = type;
+	if(source) {
+		new_node.type = source->type;
+		new_node.size = source->size;
+		memcpy(new_node.blocks, source->blocks, sizeof(new_node.blocks));
+	}
 	unsigned int dir_idx = FS_DIRENTRIES, block_idx;
 	fs_direntry final_dirblock[FS_DIRENTRIES];
 
 	for(unsigned int i = 0; i < i_node.size; ++i) {
-		disk_readblock(i_node.blocks[i], (void*)dir_block);
+		dev_readblock(i_node.blocks[i], (void*)dir_block);
 		for(unsigned int j = 0; j < FS_DIRENTRIES; ++j) {
 			//Empty direntry
 			if(dir_block[j].inode_block == 0 && dir_idx == FS_DIRENTRIES) {
@@ -117,43 +326,47 @@ bool create_path(const std::string path, fs_inode &i_node, uint32_t path_num, co
 				}
 			}
 
-			if(dir_block[j].inode_block != 0 && strcmp(dir_block[j].name, path.c_str()) == 0) { //TODO: OH file and directory same name
+			if(dir_block[j].inode_block != 0 && path == dir_block[j].name) { //TODO: OH file and directory same name
 				return false; //TODO looping all the way through, show we use a separate structure?
 			}
 		}
 	}
 	if(dir_idx != FS_DIRENTRIES) {
-		strcpy(final_dirblock[dir_idx].name, path.c_str());
-		disk_writeblock(free_block, (void*)&new_node); 
+		uint32_t inode_block;
+		if(!take_free_blocks(1, &inode_block)) {
+			return false;
+		}
+		copy_name(final_dirblock[dir_idx].name, path);
+		final_dirblock[dir_idx].inode_block = inode_block;
 
-		final_dirblock[dir_idx].inode_block = free_block;
-		disk_writeblock(i_node.blocks[block_idx], (void*)final_dirblock);
-		free_blocks.pop();
+		Dev_write writes[] = {{inode_block, &new_node}, {i_node.blocks[block_idx], final_dirblock}};
+		dev_commit(writes, 2);
 		return true;
 	}
 	//Need to create new block
 	if(i_node.size >= FS_MAXFILEBLOCKS) {
 		return false;
 	}
-	
-	disk_writeblock(free_block, (void*)&new_node);
+	//One block for the inode, one for the new direntry block
+	uint32_t new_blocks[2];
+	if(!take_free_blocks(2, new_blocks)) {
+		return false;
+	}
+	uint32_t inode_block = new_blocks[0];
 
 	//Creates new direntry block to put file inode into
 	fs_direntry new_dir_block[FS_DIRENTRIES];
-    strcpy(new_dir_block[0].name, path.c_str());
-	new_dir_block[0].inode_block = free_block;
+    copy_name(new_dir_block[0].name, path);
+	new_dir_block[0].inode_block = inode_block;
 	for(unsigned int i = 1; i < FS_DIRENTRIES; ++i) {
 		new_dir_block[i].inode_block = 0;
 	}
-	free_blocks.pop();
-	free_block = free_blocks.front();
-	disk_writeblock(free_block, (void*)new_dir_block);
-	i_node.blocks[i_node.size] = free_block;
+	i_node.blocks[i_node.size] = new_blocks[1];
 	i_node.size++;
 
-	//Updates overall inode
-	disk_writeblock(path_num, (void*)&i_node); 
-	free_blocks.pop();
+	//New inode, new direntry block and the updated overall inode
+	Dev_write writes[] = {{inode_block, &new_node}, {new_blocks[1], new_dir_block}, {path_num, &i_node}};
+	dev_commit(writes, 3);
 	return true;
 }
 
@@ -162,51 +375,223 @@ bool create_path(const std::string path, fs_inode &i_node, uint32_t path_num, co
 	i_node: the directory before the deleted file (1 level up)
 	path_num: i_node's block number
 	final_path: name of the file/directory to be deleted	*/
-bool delete_path(fs_inode &i_node, uint32_t path_num, const std::string &final_path, const std::string &username) {
+bool delete_path(fs_inode &i_node, uint32_t path_num, std::string_view final_path, std::string_view username) {
 
 	//i_node points to the path right before the one getting deleted
 	fs_direntry dir_block[FS_DIRENTRIES];
 
     uint32_t direntry_idx, block_idx;
-    uint32_t final_block = FS_DISKSIZE;
-
-	for(uint32_t i = 0; i < i_node.size; ++i) {
-		disk_readblock(i_node.blocks[i], (void*)dir_block);
-		for(unsigned int j = 0; j < FS_DIRENTRIES; ++j) {
-			std::string dir_name(dir_block[j].name);
-			if(dir_name == final_path && dir_block[j].inode_block != 0) {
-				final_block = dir_block[j].inode_block;
-				direntry_idx = j;
-				block_idx = i;
-				break;
-			}
-		}
-		if(final_block < FS_DISKSIZE)
-			break;
-	}
+    uint32_t final_block = find_direntry(i_node, final_path, dir_block, block_idx, direntry_idx);
 
-	if(final_block == FS_DISKSIZE) {
+	if(final_block == fs_disksize) {
 		return false;
 	}
 
 	fs_inode victim;
 	Lock_RAII victim_lock(&inode_locks[final_block]);
-	Lock_RAII q_mutex(&q_lock);
 
-	disk_readblock(final_block, (void*)&victim);
-	if(strcmp(victim.owner, username.c_str()) != 0)
+	dev_readblock(final_block, (void*)&victim);
+	if(username != victim.owner)
 	{
 		return false;
 	}
-	if(victim.type == 'f') {
-		delete_file(victim); 
+
+	Block_list freed(request_arena());
+	if(is_file(victim)) {
+		recall_leases(&final_block, 1);
+		delete_file(victim, freed); 
 	}
 	else if(victim.size > 0){
 		return false;
 	}
 
     //delete dir entry in both cases, check if direntry array is empty, do writes
-	free_blocks.push(final_block);
+	freed.push_back(final_block);
+	remove_direntry(i_node, path_num, dir_block, block_idx, direntry_idx, freed);
+	free_block_batch(freed);
+
+	return true;
+
+
+}
+
+/*	-Called on FS_COPY requests-
+	Creates a file at dest_paths that shares source's data blocks.  The
+	blocks are copied only when either file later writes them.
+	source: inode of the file being copied, locked through lck
+	dest_paths: path of the new file
+	lck: holds source's lock; on return it holds the lock of whatever
+	     the destination traversal stopped at			*/
+bool copy_path(fs_inode &source, const Path_list &dest_paths, std::string_view username, Lock_RAII &lck) {
+	if(!is_file(source)) {
+		return false;
+	}
+	//An inline file's data is copied with its inode
+	Block_list shared(request_arena());
+	for(uint32_t i = 0; source.type == 'f' && i < source.size; ++i) {
+		if(source.blocks[i] != FS_HOLE) {
+			shared.push_back(source.blocks[i]);
+		}
+	}
+	share_blocks(shared);
+
+	//Let go of the source before taking the root for the destination, so
+	//locks are only ever taken from the root down.  The references taken
+	//above keep the shared blocks even if the source changes meanwhile.
+	lck.raii_unlock();
+	lck.lock = &inode_locks[0];
+	{
+		Phase_RAII phase("inode lock");
+		lck.lock->lock();
+	}
+
+	fs_inode parent;
+	uint32_t parent_num = pathTraversal(dest_paths, parent, "FS_CREATE", username, lck);
+	if(parent_num == fs_disksize || parent.type != 'd' ||
+	   !create_path(dest_paths[dest_paths.size() - 1], parent, parent_num, username, 'f', &source)) {
+		free_block_batch(shared);
+		return false;
+	}
+	return true;
+}
+
+/*	-Called on FS_DELETE_TREE requests-
+	Deletes a file, or a directory and everything below it, in one pass.
+	Every freed block is returned to free_blocks at once and the parent
+	is rewritten once.
+	i_node: the directory before the deleted file (1 level up)
+	path_num: i_node's block number
+	final_path: name of the file/directory to be deleted	*/
+bool delete_tree(fs_inode &i_node, uint32_t path_num, std::string_view final_path, std::string_view username) {
+	fs_direntry dir_block[FS_DIRENTRIES];
+
+	uint32_t direntry_idx, block_idx;
+	uint32_t final_block = find_direntry(i_node, final_path, dir_block, block_idx, direntry_idx);
+
+	if(final_block == fs_disksize) {
+		return false;
+	}
+
+	//Holding the parent keeps new requests out of the subtree
+	Lock_RAII victim_lock(&inode_locks[final_block]);
+	fs_inode victim;
+	dev_readblock(final_block, (void*)&victim);
+	if(username != victim.owner)
+	{
+		return false;
+	}
+
+	Block_list freed(request_arena());
+	collect_tree(victim, final_block, freed);
+	//Holds the inode blocks of every file in the tree, among others
+	recall_leases(freed.data(), freed.size());
+
+	remove_direntry(i_node, path_num, dir_block, block_idx, direntry_idx, freed);
+	free_block_batch(freed);
+	return true;
+}
+
+
+/*----------------------------HELPERS-----------------------------*/
+
+//Deals with deleteing an inode if its a file
+//Adds the file's data blocks to freed
+void delete_file(fs_inode &file, Block_list &freed) {
+	for(uint32_t i = 0; file.type == 'f' && i < file.size; ++i) {
+		if(file.blocks[i] == FS_HOLE) {
+			continue;
+		}
+		std::cout << "freeing data block " << file.blocks[i] << std::endl;
+		freed.push_back(file.blocks[i]);
+	}
+	file.size = 0;
+}
+
+//Returns blocks to free_blocks, taking q_lock once for the whole batch
+//A block shared by copies only loses one reference
+void free_block_batch(const Block_list &blocks) {
+	Lock_RAII q_mutex(&q_lock);
+	for(uint32_t block : blocks) {
+		auto refs = block_refs.find(block);
+		if(refs == block_refs.end()) {
+			free_blocks.push(block);
+			free_map[block] = true;
+			free_count++;
+		}
+		else if(--refs->second == 1) {
+			block_refs.erase(refs);
+		}
+	}
+}
+
+//Adds a reference to each data block for a new copy of a file
+void share_blocks(const Block_list &blocks) {
+	Lock_RAII q_mutex(&q_lock);
+	for(uint32_t block : blocks) {
+		uint32_t &refs = block_refs[block];
+		refs = (refs == 0) ? 2 : refs + 1;
+	}
+}
+
+/*
+	Decides where a write to data block "block" goes.  An unshared block
+	is written in place; for a shared block a free block is taken and the
+	old block loses one reference.
+	Returns the block to write, or fs_disksize if the disk is full
+*/
+uint32_t take_cow_block(uint32_t block) {
+	Lock_RAII q_mutex(&q_lock);
+	auto refs = block_refs.find(block);
+	if(refs == block_refs.end()) {
+		return block;
+	}
+	if(free_count == 0) {
+		return fs_disksize;
+	}
+	uint32_t copy = pop_free_block();
+	if(--refs->second == 1) {
+		block_refs.erase(refs);
+	}
+	return copy;
+}
+
+//True if any of blocks is shared with a copy
+bool blocks_shared(const uint32_t blocks[], uint32_t count) {
+	Lock_RAII q_mutex(&q_lock);
+	for(uint32_t i = 0; i < count; ++i) {
+		if(block_refs.count(blocks[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+	Finds the direntry called name in directory i_node
+	dir_block: filled with the direntry block holding the entry
+	block_idx/direntry_idx: set to the entry's position
+	Returns the entry's inode block, or fs_disksize if there is none
+*/
+uint32_t find_direntry(fs_inode &i_node, std::string_view name, fs_direntry dir_block[], uint32_t &block_idx, uint32_t &direntry_idx) {
+	for(uint32_t i = 0; i < i_node.size; ++i) {
+		dev_readblock(i_node.blocks[i], (void*)dir_block);
+		for(unsigned int j = 0; j < FS_DIRENTRIES; ++j) {
+			if(dir_block[j].inode_block != 0 && name == dir_block[j].name) {
+				direntry_idx = j;
+				block_idx = i;
+				return dir_block[j].inode_block;
+			}
+		}
+	}
+	return fs_disksize;
+}
+
+/*
+	Clears the direntry found by find_direntry and writes the change:
+	the direntry block, or the directory inode if the block became empty
+	(the block is then added to freed)
+*/
+void remove_direntry(fs_inode &i_node, uint32_t path_num, fs_direntry dir_block[], uint32_t block_idx, uint32_t direntry_idx, Block_list &freed) {
 	dir_block[direntry_idx].inode_block = 0;
 
 	bool empty = true;
@@ -218,32 +603,68 @@ bool delete_path(fs_inode &i_node, uint32_t path_num, const std::string &final_p
 	}
 
 	if(empty) {
-		free_blocks.push(i_node.blocks[block_idx]);
+		freed.push_back(i_node.blocks[block_idx]);
 		for(unsigned int i = block_idx; i < i_node.size - 1; ++i) {
 			i_node.blocks[i] = i_node.blocks[i+1];
 		}
 		i_node.size--;
-		disk_writeblock(path_num, (void*)&i_node);
+		Dev_write inode_write = {path_num, &i_node};
+		dev_commit(&inode_write, 1);
 	}
 	else {
-		disk_writeblock(i_node.blocks[block_idx], (void*)dir_block);
+		Dev_write dir_write = {i_node.blocks[block_idx], dir_block};
+		dev_commit(&dir_write, 1);
 	}
-
-	return true;
-
-
 }
 
+//Adds dir's direntry blocks and its files' blocks to freed, and queues its
+//subdirectories.  The caller holds dir's lock.
+static void collect_dir(fs_inode &dir, std::pmr::deque<uint32_t> &dirs, Block_list &freed) {
+	fs_direntry dir_block[FS_DIRENTRIES];
+	for(uint32_t i = 0; i < dir.size; ++i) {
+		freed.push_back(dir.blocks[i]);
+		dev_readblock(dir.blocks[i], (void*)dir_block);
+		for(unsigned int j = 0; j < FS_DIRENTRIES; ++j) {
+			uint32_t child_num = dir_block[j].inode_block;
+			if(child_num == 0) {
+				continue;
+			}
+			freed.push_back(child_num);
+			fs_inode child;
+			Lock_RAII child_lock(&inode_locks[child_num]);
+			dev_readblock(child_num, (void*)&child);
+			if(is_file(child)) {
+				delete_file(child, freed);
+			}
+			else {
+				dirs.push_back(child_num);
+			}
+		}
+	}
+}
 
-/*----------------------------HELPERS-----------------------------*/
+/*
+	Adds every block of the subtree rooted at root (inode at root_num,
+	already locked by the caller) to freed: data, direntry and inode blocks.
+	Each inode below root is locked while it is read, so requests still
+	working inside the subtree finish first.
+*/
+void collect_tree(fs_inode &root, uint32_t root_num, Block_list &freed) {
+	freed.push_back(root_num);
+	if(is_file(root)) {
+		delete_file(root, freed);
+		return;
+	}
 
-//Deals with deleteing an inode if its a file
-void delete_file(fs_inode &file) {
-	for(uint32_t i = 0; i < file.size; ++i) {
-		std::cout << "freeing data block " << file.blocks[i] << std::endl;
-		free_blocks.push(file.blocks[i]);
+	std::pmr::deque<uint32_t> dirs(request_arena());
+	collect_dir(root, dirs, freed);
+	while(!dirs.empty()) {
+		fs_inode dir;
+		Lock_RAII dir_lock(&inode_locks[dirs.front()]);
+		dev_readblock(dirs.front(), (void*)&dir);
+		dirs.pop_front();
+		collect_dir(dir, dirs, freed);
 	}
-	file.size = 0;
 }
 
 /*
@@ -254,19 +675,19 @@ void delete_file(fs_inode &file) {
 	command: command entered by user
 	username: name of user
 */
-uint32_t pathTraversal(const std::vector<std::string> &path, fs_inode &inode, const std::string &command, const std::string &username, Lock_RAII &lck) {
+uint32_t pathTraversal(const Path_list &path, fs_inode &inode, std::string_view command, std::string_view username, Lock_RAII &lck) {
 	// "/dir/beach/pie"
 	uint32_t block_num = 0;
 
 
 	//inode_locks[block_num].lock();
 	if(command == "FS_CREATE" && path.size() == 0) {
-		return FS_DISKSIZE;
+		return fs_disksize;
 	}
 
 	//inode_locks[block_num].lock();
-	disk_readblock(0, (void*)&inode);
-	bool is_create_or_delete = (command == "FS_CREATE" || command == "FS_DELETE");
+	dev_readblock(0, (void*)&inode);
+	bool is_create_or_delete = (command == "FS_CREATE" || command == "FS_DELETE" || command == "FS_DELETE_TREE");
 	size_t path_size = path.size(); 
 	if(is_create_or_delete) 
 	{
@@ -279,47 +700,51 @@ uint32_t pathTraversal(const std::vector<std::string> &path, fs_inode &inode, co
 		if(inode.type == 'd') { 
 			block_num = find_node(inode, path[i], username, i, lck);
 
-            if(block_num == FS_DISKSIZE)
-                return FS_DISKSIZE;
+            if(block_num == fs_disksize)
+                return fs_disksize;
 		}
 		else if(!is_create_or_delete && i < path_size - 1) {
-			return FS_DISKSIZE;
+			return fs_disksize;
 		}
 
-		if(is_create_or_delete && inode.type == 'f') {
-			return FS_DISKSIZE;
+		if(is_create_or_delete && is_file(inode)) {
+			return fs_disksize;
 		}
 	}
 	return block_num;
 }
 
-//Returns the block number of the directory/file that is to be modified or FS_DISKSIZE if not found
-unsigned int find_node(fs_inode &inode, const std::string &path, const std::string &username, size_t idx, Lock_RAII &lck) {
+Lock_RAII lock_inode(uint32_t block) {
+	Phase_RAII phase("inode lock");
+	return Lock_RAII(&inode_locks[block]);
+}
+
+//Returns the block number of the directory/file that is to be modified or fs_disksize if not found
+unsigned int find_node(fs_inode &inode, std::string_view path, std::string_view username, size_t idx, Lock_RAII &lck) {
 
     fs_direntry dir_block[FS_DIRENTRIES];
 
 	for(uint32_t i = 0; i < inode.size; ++i) {
-		disk_readblock(inode.blocks[i], (void*)dir_block);
+		dev_readblock(inode.blocks[i], (void*)dir_block);
 		//Traverse every direntry in block to see if one is path[i]
 		for(unsigned int j = 0; j < FS_DIRENTRIES; ++j) {
 			if(dir_block[j].inode_block != 0) {
-				std::string dir_name(dir_block[j].name);
 				assert(inode.type == 'd');
-				if(dir_name == path) { 
+				if(path == dir_block[j].name) { 
 					//block_num = dir_block[k].inode_block;
 
 					//Updates input parameter
 					//inode_locks[dir_block[j].inode_block].lock();
 					//inode_locks[block_num].unlock();	//pass in block num
 
-					Lock_RAII new_lck(&inode_locks[dir_block[j].inode_block]);
-					std::swap(lck, new_lck);
+					Lock_RAII new_lck = lock_inode(dir_block[j].inode_block);
+					std::swap(lck.lock, new_lck.lock);	//new_lck now releases the parent
 					
-					disk_readblock(dir_block[j].inode_block, (void*)&inode);
+					dev_readblock(dir_block[j].inode_block, (void*)&inode);
 					//inode_locks[block_num].unlock();
-					if(strcmp(inode.owner, username.c_str()) != 0) {
+					if(username != inode.owner) {
                         if(idx == 0) {
-                            return FS_DISKSIZE; //user does not own the directory
+                            return fs_disksize; //user does not own the directory
                         }
                         else {
                             assert(false); //file system is incorrect so break
@@ -331,5 +756,5 @@ unsigned int find_node(fs_inode &inode, const std::string &path, const std::stri
 			}
 		}
 	}
-	return FS_DISKSIZE;
+	return fs_disksize;
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #include "fs_client.h"
 #include "fs_server.h"
+#include "fs_arena.h"
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 class Lock_RAII
@@ -14,6 +16,9 @@ class Lock_RAII
 			lock = m;
 			lock->lock();
 		}
+		//Copies would unlock the same mutex twice
+		Lock_RAII(const Lock_RAII &) = delete;
+		Lock_RAII &operator=(const Lock_RAII &) = delete;
 		void raii_unlock()
 		{
 			lock->unlock();
@@ -23,6 +28,26 @@ class Lock_RAII
 			lock->unlock();
 		}
 };
+
+//A file block entry with no disk block behind it reads as all zeros
+//Block 0 always holds the root inode, so it is never a file's data block
+const uint32_t FS_HOLE = 0;
+
+//Type of a file of one block kept in its inode, in place of the blocks
+//array.  Only a block whose bytes past FS_INLINE_BYTES are zero fits.
+const char FS_INLINE = 'i';
+const unsigned int FS_INLINE_BYTES = sizeof(fs_inode::blocks);
+
+//True for ordinary and inline files, false for directories
+inline bool is_file(const fs_inode &node) {
+	return node.type == 'f' || node.type == FS_INLINE;
+}
+
+/*	-Called once at startup, before any request-
+	Replays the metadata log, finds the free and shared blocks by walking
+	the file system, and starts the log if FS_WAL_BLOCKS is set		*/
+void init();
+
 /*--------------------READ/WRITE/CREATE/DELETE------------------------*/
 //All return false if instruction cannot be completed, else true
 
@@ -48,8 +73,18 @@ bool write_block(fs_inode &i_node, char data[], uint32_t path_num, uint32_t bloc
 	path_num: i_node's block number
 	username: name of the person creating a file
 	final_path: name of the file/directory to be deleted
-	type: 'f' or 'd' for file or directory					*/
-bool create_path(const std::string path, fs_inode &i_node, uint32_t path_num, const std::string &username, char type);
+	type: 'f' or 'd' for file or directory
+	source: inode whose blocks the new file starts with, or nullptr	*/
+bool create_path(std::string_view path, fs_inode &i_node, uint32_t path_num, std::string_view username, char type, const fs_inode *source = nullptr);
+
+/*	-Called on FS_COPY requests-
+	Creates a file at dest_paths that shares source's data blocks.  The
+	blocks are copied only when either file later writes them.
+	source: inode of the file being copied, locked through lck
+	dest_paths: path of the new file
+	lck: holds source's lock; on return it holds the lock of whatever
+	     the destination traversal stopped at			*/
+bool copy_path(fs_inode &source, const Path_list &dest_paths, std::string_view username, Lock_RAII &lck);
 
 
 /*	-Called on FS_DELETE requests-
@@ -57,19 +92,83 @@ bool create_path(const std::string path, fs_inode &i_node, uint32_t path_num, co
 	i_node: the directory before the deleted file (1 level up)
 	path_num: i_node's block number
 	final_path: name of the file/directory to be deleted	*/
-bool delete_path(fs_inode &i_node, uint32_t path_num, const std::string &final_path, const std::string &username);
+bool delete_path(fs_inode &i_node, uint32_t path_num, std::string_view final_path, std::string_view username);
+
+/*	-Called on FS_DELETE_TREE requests-
+	Deletes a file, or a directory and everything below it, in one pass.
+	Every freed block is returned to free_blocks at once and the parent
+	is rewritten once.
+	i_node: the directory before the deleted file (1 level up)
+	path_num: i_node's block number
+	final_path: name of the file/directory to be deleted	*/
+bool delete_tree(fs_inode &i_node, uint32_t path_num, std::string_view final_path, std::string_view username);
 
 
 /*----------------------------HELPERS-----------------------------*/
 
 //Deals with deleteing an inode if its a file
-void delete_file(fs_inode &file);
+//Adds the file's data blocks to freed
+void delete_file(fs_inode &file, Block_list &freed);
+
+//Returns blocks to free_blocks, taking q_lock once for the whole batch
+//A block shared by copies only loses one reference
+void free_block_batch(const Block_list &blocks);
+
+/*
+	Takes count consecutive free blocks, for the defragmenter.  The disk is
+	searched a stretch at a time with q_lock let go in between, so
+	allocating requests never wait for a scan of the whole disk.
+	start: set to the first block of the run
+	Returns false if no run that long is free
+*/
+bool take_free_run(uint32_t count, uint32_t &start);
+
+//Adds a reference to each data block for a new copy of a file
+void share_blocks(const Block_list &blocks);
+
+/*
+	Decides where a write to data block "block" goes.  An unshared block
+	is written in place; for a shared block a free block is taken and the
+	old block loses one reference.
+	Returns the block to write, or fs_disksize if the disk is full
+*/
+uint32_t take_cow_block(uint32_t block);
+
+//True if any of blocks is shared with a copy
+bool blocks_shared(const uint32_t blocks[], uint32_t count);
+
+/*
+	Finds the direntry called name in directory i_node
+	dir_block: filled with the direntry block holding the entry
+	block_idx/direntry_idx: set to the entry's position
+	Returns the entry's inode block, or fs_disksize if there is none
+*/
+uint32_t find_direntry(fs_inode &i_node, std::string_view name, fs_direntry dir_block[], uint32_t &block_idx, uint32_t &direntry_idx);
+
+/*
+	Clears the direntry found by find_direntry and writes the change:
+	the direntry block, or the directory inode if the block became empty
+	(the block is then added to freed)
+*/
+void remove_direntry(fs_inode &i_node, uint32_t path_num, fs_direntry dir_block[], uint32_t block_idx, uint32_t direntry_idx, Block_list &freed);
+
+/*
+	Adds every block of the subtree rooted at root (inode at root_num,
+	already locked by the caller) to freed: data, direntry and inode blocks
+*/
+void collect_tree(fs_inode &root, uint32_t root_num, Block_list &freed);
+
+/*
+	Locks inode_locks[block]; the wait is recorded as an "inode lock" phase
+	when the request is phase traced
+*/
+Lock_RAII lock_inode(uint32_t block);
 
 /*
 	Uses &path to linearly search from root til the critical part in path
 	Create/Delete return block_num for the directory in which specified file/folder is
 	Read/Write return block_num to the file they wish to write/read to
 */
-uint32_t pathTraversal(const std::vector<std::string> &path, fs_inode &inode, const std::string &command, const std::string &username, Lock_RAII &lck);
+uint32_t pathTraversal(const Path_list &path, fs_inode &inode, std::string_view command, std::string_view username, Lock_RAII &lck);
 
-unsigned int find_node(fs_inode &inode, const std::string &path, const std::string &username, size_t idx, Lock_RAII &lck);
\ No newline at end of file
+unsigned int find_node(fs_inode &inode, std::string_view path, std::string_view username, size_t idx, Lock_RAII &lck);
\ No newline at end of file
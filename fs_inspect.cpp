@@ -0,0 +1,666 @@
+/*
+ * fs_inspect
+ *
+ * Checks and describes a file system offline, from a disk image made by
+ * fs_mkfs or the disk file of libfs_server.o.  The image is mapped into
+ * memory and the tree is walked by several threads at once.  Every block
+ * the tree refers to is counted, which rebuilds the allocation the server
+ * works out at startup, and checked for being out of range, inside the
+ * write-ahead log, or used twice (data blocks shared by copies excepted).
+ * Then fragmentation, directory fill and each user's blocks are reported.
+ *
+ * With -s the tree is printed instead, in the format of showfs.
+ *
+ * Usage: fs_inspect [-s] [-t threads] [disk]
+ *	-s		print the tree like showfs
+ *	-t threads	threads walking the tree (default one per core)
+ *	disk		an image, or the images of a striped disk separated by
+ *			commas; default $FS_DISK, else the disk of libfs_server.o
+ */
+
+#include "fs_server.h"
+#include "fs_filesystem.h"
+#include "fs_device.h"
+#include "fs_wal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+//What a block was found to hold
+enum Block_kind : uint8_t {
+	BLOCK_FREE = 0,
+	BLOCK_INODE,
+	BLOCK_DIRECTORY,
+	BLOCK_DATA,
+};
+
+static const char *const KIND_NAMES[] = {"free", "inode", "directory", "data"};
+
+//A file or directory reached by the walk
+struct Inspect_node {
+	std::string path;
+	uint32_t block;					//inode block
+	bool valid = false;				//inode passed the checks
+	//Used entries of a directory, with their entry numbers
+	std::vector<std::pair<uint32_t, Inspect_node *>> entries;
+};
+
+//Blocks and inodes of one user
+struct User_usage {
+	uint64_t files = 0;
+	uint64_t directories = 0;
+	uint64_t metadata_blocks = 0;		//inodes and directory blocks
+	uint64_t data_blocks = 0;		//counting shared blocks once per file
+};
+
+//Counts gathered by one walking thread
+struct Inspect_stats {
+	uint64_t files = 0;
+	uint64_t inline_files = 0;
+	uint64_t files_with_blocks = 0;
+	uint64_t directories = 0;
+	uint64_t file_blocks = 0;		//data block references
+	uint64_t holes = 0;
+	uint64_t extents = 0;			//contiguous runs of data blocks
+	uint64_t contiguous_files = 0;		//files of one extent
+	uint64_t worst_extents = 0;
+	std::string worst_file;
+	uint64_t dir_blocks = 0;
+	uint64_t dir_entries = 0;
+	uint64_t compactable_dirs = 0;		//would fit in fewer blocks
+	uint64_t fill_histogram[4] = {};	//directories by quarter filled
+	std::map<std::string, User_usage> users;
+
+	void merge(const Inspect_stats &other);
+};
+
+void Inspect_stats::merge(const Inspect_stats &other) {
+	files += other.files;
+	inline_files += other.inline_files;
+	files_with_blocks += other.files_with_blocks;
+	directories += other.directories;
+	file_blocks += other.file_blocks;
+	holes += other.holes;
+	extents += other.extents;
+	contiguous_files += other.contiguous_files;
+	if(other.worst_extents > worst_extents) {
+		worst_extents = other.worst_extents;
+		worst_file = other.worst_file;
+	}
+	dir_blocks += other.dir_blocks;
+	dir_entries += other.dir_entries;
+	compactable_dirs += other.compactable_dirs;
+	for(unsigned int i = 0; i < 4; ++i) {
+		fill_histogram[i] += other.fill_histogram[i];
+	}
+	for(auto &user : other.users) {
+		User_usage &usage = users[user.first];
+		usage.files += user.second.files;
+		usage.directories += user.second.directories;
+		usage.metadata_blocks += user.second.metadata_blocks;
+		usage.data_blocks += user.second.data_blocks;
+	}
+}
+
+/*
+	A mapped disk, and the walk over its tree.
+	Worker threads take nodes off a shared stack; a directory pushes its
+	entries for any thread to pick up.  Block references are counted in
+	atomics so the threads never wait on each other for them.
+*/
+class Inspector
+{
+	public:
+
+		//Maps path read-only, false (with a message) if it is not a disk
+		bool open(const char *path);
+
+		//Walks the whole tree with threads threads
+		void walk(unsigned int threads);
+
+		//Prints the tree in the format of showfs
+		void print_tree() const;
+
+		//Prints the checks and statistics
+		void print_report() const;
+
+		bool has_errors() const
+		{
+			return !errors.empty();
+		}
+
+	private:
+
+		const char *block_data(uint32_t block) const
+		{
+			uint32_t member;
+			uint32_t member_block = dev_stripe_block(block, bases.size(), stripe_blocks, member);
+			return bases[member] + (size_t)member_block * FS_BLOCKSIZE;
+		}
+
+		void worker(Inspect_stats &stats);
+		void visit(Inspect_node *node, Inspect_stats &stats);
+		bool claim(uint32_t block, Block_kind kind, const Inspect_node *node);
+		void error(const std::string &message);
+		void print_node(const Inspect_node *node) const;
+
+		std::vector<const char *> bases;	//first block on each image, in stripe set order
+		uint32_t stripe_blocks = 1;
+		uint32_t disk_blocks = 0;
+		uint32_t log_start = 0;			//first block of the log, disk_blocks if none
+		std::string description;
+
+		std::vector<std::atomic<uint32_t>> refs;
+		std::vector<std::atomic<uint8_t>> kinds;
+		std::vector<std::unique_ptr<Inspect_node>> nodes;
+		Inspect_node *root = nullptr;
+		Inspect_stats totals;
+
+		std::mutex lock;			//guards everything below
+		std::condition_variable work_ready;
+		std::vector<Inspect_node *> pending;
+		unsigned int busy = 0;			//threads visiting a node
+		std::vector<std::string> errors;
+};
+
+//Maps path read-only; returns its bytes, or nullptr (with a message)
+static const char *map_file(const char *path, off_t &size) {
+	int fd = ::open(path, O_RDONLY);
+	struct stat st;
+	if(fd == -1 || fstat(fd, &st) == -1) {
+		perror(path);
+		return nullptr;
+	}
+	if(st.st_size < (off_t)FS_BLOCKSIZE) {
+		fprintf(stderr, "%s: too small to hold a file system\n", path);
+		close(fd);
+		return nullptr;
+	}
+	void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mem == MAP_FAILED) {
+		perror(path);
+		return nullptr;
+	}
+	size = st.st_size;
+	return (const char *)mem;
+}
+
+bool Inspector::open(const char *path) {
+	//The images of a stripe set are given separated by commas
+	std::vector<std::string> paths;
+	std::string list(path);
+	for(size_t start = 0, end; start <= list.size(); start = end + 1) {
+		end = std::min(list.find(',', start), list.size());
+		paths.push_back(list.substr(start, end - start));
+	}
+
+	bases.assign(paths.size(), nullptr);
+	Dev_superblock first;
+	for(size_t i = 0; i < paths.size(); ++i) {
+		const char *name = paths[i].c_str();
+		off_t size;
+		const char *mem = map_file(name, size);
+		if(mem == nullptr) {
+			return false;
+		}
+		Dev_superblock super;
+		memcpy(&super, mem, sizeof(super));
+		if(memcmp(super.magic, DEV_IMAGE_MAGIC, sizeof(super.magic)) != 0) {
+			//The disk of libfs_server.o is the blocks alone, 512 bytes each
+			if(FS_BLOCKSIZE != 512 || paths.size() > 1) {
+				fprintf(stderr, "%s: not a disk image made by fs_mkfs\n", name);
+				return false;
+			}
+			bases[0] = mem;
+			disk_blocks = size / FS_BLOCKSIZE;
+			description = "libfs_server.o disk";
+			break;
+		}
+		if(super.block_size != FS_BLOCKSIZE) {
+			fprintf(stderr, "%s: formatted with %u byte blocks, fs_inspect was built for %u\n",
+				name, super.block_size, FS_BLOCKSIZE);
+			return false;
+		}
+		if(i == 0) {
+			first = super;
+		}
+		uint32_t members = super.members ? super.members : 1;
+		uint32_t member = members > 1 ? super.member : 0;
+		if(members != paths.size() || super.set_id != first.set_id || super.disk_blocks != first.disk_blocks ||
+		   super.stripe_blocks != first.stripe_blocks ||
+		   (members > 1 && (super.stripe_blocks == 0 || member >= members || bases[member] != nullptr))) {
+			fprintf(stderr, "%s: not one of %zu images of the same stripe set\n", name, paths.size());
+			return false;
+		}
+		stripe_blocks = members > 1 ? super.stripe_blocks : 1;
+		//The image must reach the last block of the disk that lands on it,
+		//in the last stripe it holds
+		uint64_t image_blocks = 0;
+		uint64_t stripes = ((uint64_t)super.disk_blocks + stripe_blocks - 1) / stripe_blocks;
+		if(member < stripes) {
+			uint64_t stripe = member + (stripes - 1 - member) / members * members;
+			uint32_t block = std::min<uint64_t>((stripe + 1) * stripe_blocks, super.disk_blocks) - 1;
+			uint32_t holder;
+			image_blocks = dev_stripe_block(block, members, stripe_blocks, holder) + 1;
+		}
+		if((off_t)(image_blocks + 1) * FS_BLOCKSIZE > size) {
+			fprintf(stderr, "%s: shorter than its superblock says\n", name);
+			return false;
+		}
+		bases[member] = mem + FS_BLOCKSIZE;
+		disk_blocks = super.disk_blocks;
+		description = members > 1 ? "disk striped across " + std::to_string(members) + " images" : "disk image";
+	}
+
+	if(disk_blocks < 2) {
+		fprintf(stderr, "%s: too small to hold a file system\n", path);
+		return false;
+	}
+
+	log_start = disk_blocks;
+	wal_header header;
+	memcpy(&header, block_data(disk_blocks - 1), sizeof(header));
+	if(header.magic == WAL_MAGIC && header.size >= 2 && header.size <= disk_blocks / 2) {
+		log_start = disk_blocks - header.size;
+	}
+
+	refs = std::vector<std::atomic<uint32_t>>(disk_blocks);
+	kinds = std::vector<std::atomic<uint8_t>>(disk_blocks);
+	return true;
+}
+
+void Inspector::error(const std::string &message) {
+	std::lock_guard<std::mutex> lck(lock);
+	errors.push_back(message);
+}
+
+/*	Counts a reference from node to block
+	Returns false if the block must not be followed: out of range, in the
+	log, or already taken by something it cannot be shared with		*/
+bool Inspector::claim(uint32_t block, Block_kind kind, const Inspect_node *node) {
+	std::string where = node->path + ": " + KIND_NAMES[kind] + " block " + std::to_string(block);
+	if(block >= log_start) {
+		error(where + (block < disk_blocks ? " is inside the log" : " is out of range"));
+		return false;
+	}
+	uint8_t found = BLOCK_FREE;
+	if(!kinds[block].compare_exchange_strong(found, kind) && found != kind) {
+		error(where + " is also used as a " + KIND_NAMES[found] + " block");
+		refs[block]++;
+		return false;
+	}
+	//Copies share data blocks; anything else is used once
+	if(refs[block]++ != 0 && kind != BLOCK_DATA) {
+		error(where + " already used");
+		return false;
+	}
+	return true;
+}
+
+/*	-Called on a walking thread for each node-
+	Checks the node's inode and, for a directory, its entries, which
+	become new nodes to visit							*/
+void Inspector::visit(Inspect_node *node, Inspect_stats &stats) {
+	if(!claim(node->block, BLOCK_INODE, node)) {
+		return;
+	}
+	fs_inode inode;
+	memcpy(&inode, block_data(node->block), sizeof(inode));
+
+	if(inode.type != 'f' && inode.type != 'd' && inode.type != FS_INLINE) {
+		error(node->path + ": unknown type " + std::string(1, inode.type));
+		return;
+	}
+	if(memchr(inode.owner, '\0', sizeof(inode.owner)) == nullptr ||
+	   (node != root && inode.owner[0] == '\0')) {
+		error(node->path + ": malformed owner");
+		return;
+	}
+	if(inode.size > FS_MAXFILEBLOCKS || (inode.type == FS_INLINE && inode.size > 1)) {
+		error(node->path + ": size " + std::to_string(inode.size) + " is too big");
+		return;
+	}
+	node->valid = true;
+	User_usage &usage = stats.users[inode.owner];
+	usage.metadata_blocks++;
+
+	if(inode.type == FS_INLINE) {
+		stats.files++;
+		stats.inline_files++;
+		usage.files++;
+		return;
+	}
+
+	if(inode.type == 'f') {
+		stats.files++;
+		usage.files++;
+		uint64_t extents = 0;
+		uint32_t last = FS_HOLE;
+		for(uint32_t i = 0; i < inode.size; ++i) {
+			uint32_t block = inode.blocks[i];
+			if(block == FS_HOLE) {
+				stats.holes++;
+				last = FS_HOLE;
+				continue;
+			}
+			claim(block, BLOCK_DATA, node);
+			stats.file_blocks++;
+			usage.data_blocks++;
+			if(last == FS_HOLE || block != last + 1) {
+				extents++;
+			}
+			last = block;
+		}
+		stats.extents += extents;
+		stats.files_with_blocks += extents > 0;
+		if(extents == 1) {
+			stats.contiguous_files++;
+		}
+		if(extents > stats.worst_extents) {
+			stats.worst_extents = extents;
+			stats.worst_file = node->path;
+		}
+		return;
+	}
+
+	stats.directories++;
+	usage.directories++;
+	uint32_t used = 0;
+	std::set<std::string> names;
+	std::vector<Inspect_node *> children;
+	for(uint32_t i = 0; i < inode.size; ++i) {
+		uint32_t block = inode.blocks[i];
+		if(block == FS_HOLE) {
+			error(node->path + ": directory block " + std::to_string(i) + " is a hole");
+			continue;
+		}
+		if(!claim(block, BLOCK_DIRECTORY, node)) {
+			continue;
+		}
+		stats.dir_blocks++;
+		usage.metadata_blocks++;
+		fs_direntry entries[FS_DIRENTRIES];
+		memcpy(entries, block_data(block), sizeof(entries));
+		uint32_t used_here = 0;
+		for(uint32_t j = 0; j < FS_DIRENTRIES; ++j) {
+			uint32_t number = i * FS_DIRENTRIES + j;
+			const fs_direntry &entry = entries[j];
+			if(entry.inode_block == 0) {
+				continue;
+			}
+			used_here++;
+			size_t length = strnlen(entry.name, sizeof(entry.name));
+			if(length == 0 || length == sizeof(entry.name) ||
+			   memchr(entry.name, '/', length) != nullptr) {
+				error(node->path + ": malformed filename at directory entry " + std::to_string(number));
+				continue;
+			}
+			if(!names.insert(entry.name).second) {
+				error(node->path + ": " + entry.name + " appears twice");
+				continue;
+			}
+			std::unique_ptr<Inspect_node> child(new Inspect_node);
+			child->path = (node == root ? "/" : node->path + "/") + entry.name;
+			child->block = entry.inode_block;
+			node->entries.emplace_back(number, child.get());
+			children.push_back(child.get());
+			std::lock_guard<std::mutex> lck(lock);
+			nodes.push_back(std::move(child));
+		}
+		if(used_here == 0) {
+			error(node->path + ": empty direntries block (entries " + std::to_string(i * FS_DIRENTRIES) +
+			      "-" + std::to_string((i + 1) * FS_DIRENTRIES - 1) + ")");
+		}
+		used += used_here;
+	}
+	stats.dir_entries += used;
+	if(inode.size > 0) {
+		double fill = (double)used / (inode.size * FS_DIRENTRIES);
+		stats.fill_histogram[std::min(3, (int)(fill * 4))]++;
+		if((used + FS_DIRENTRIES - 1) / FS_DIRENTRIES < inode.size) {
+			stats.compactable_dirs++;
+		}
+	}
+
+	if(!children.empty()) {
+		std::lock_guard<std::mutex> lck(lock);
+		pending.insert(pending.end(), children.begin(), children.end());
+		work_ready.notify_all();
+	}
+}
+
+void Inspector::worker(Inspect_stats &stats) {
+	std::unique_lock<std::mutex> lck(lock);
+	while(true) {
+		//The walk is over once nothing is queued and nobody can add more
+		work_ready.wait(lck, [this] { return !pending.empty() || busy == 0; });
+		if(pending.empty()) {
+			return;
+		}
+		Inspect_node *node = pending.back();
+		pending.pop_back();
+		busy++;
+		lck.unlock();
+		visit(node, stats);
+		lck.lock();
+		if(--busy == 0 && pending.empty()) {
+			work_ready.notify_all();
+		}
+	}
+}
+
+void Inspector::walk(unsigned int threads) {
+	std::unique_ptr<Inspect_node> node(new Inspect_node);
+	node->path = "/";
+	node->block = 0;
+	root = node.get();
+	nodes.push_back(std::move(node));
+	pending.push_back(root);
+
+	std::vector<Inspect_stats> stats(threads);
+	std::vector<std::thread> workers;
+	for(unsigned int i = 0; i < threads; ++i) {
+		workers.emplace_back(&Inspector::worker, this, std::ref(stats[i]));
+	}
+	for(auto &thread : workers) {
+		thread.join();
+	}
+	for(auto &thread_stats : stats) {
+		totals.merge(thread_stats);
+	}
+	//Threads finish in any order
+	std::sort(errors.begin(), errors.end());
+}
+
+void Inspector::print_node(const Inspect_node *node) const {
+	fs_inode inode;
+	memcpy(&inode, block_data(node->block), sizeof(inode));
+	printf("%s (type %c) (inode block %u)\n", node->path.c_str(), inode.type, node->block);
+	printf("\towner: %s\n", inode.owner);
+	printf("\tsize: %u\n", inode.size);
+	printf("\tdata disk blocks: ");
+	if(inode.type != FS_INLINE) {
+		for(uint32_t i = 0; i < inode.size; ++i) {
+			printf("%u ", inode.blocks[i]);
+		}
+	}
+	printf("\n");
+
+	if(inode.type == 'd') {
+		for(auto &entry : node->entries) {
+			printf("\tentry %u: %s, inode block %u\n", entry.first,
+			       entry.second->path.substr(entry.second->path.rfind('/') + 1).c_str(), entry.second->block);
+		}
+		printf("\n");
+		for(auto &entry : node->entries) {
+			if(entry.second->valid) {
+				print_node(entry.second);
+			}
+		}
+		return;
+	}
+
+	//File contents, holes as zeros and an inline file's block after its data
+	static const char zeros[FS_BLOCKSIZE] = {};
+	for(uint32_t i = 0; i < inode.size; ++i) {
+		if(inode.type == FS_INLINE) {
+			fwrite(inode.blocks, 1, FS_INLINE_BYTES, stdout);
+			fwrite(zeros, 1, FS_BLOCKSIZE - FS_INLINE_BYTES, stdout);
+		}
+		else if(inode.blocks[i] == FS_HOLE || inode.blocks[i] >= log_start) {
+			fwrite(zeros, 1, FS_BLOCKSIZE, stdout);
+		}
+		else {
+			fwrite(block_data(inode.blocks[i]), 1, FS_BLOCKSIZE, stdout);
+		}
+	}
+	printf("\n\n");
+}
+
+void Inspector::print_tree() const {
+	if(root->valid) {
+		print_node(root);
+	}
+	uint64_t free_blocks = 0;
+	for(uint32_t i = 0; i < log_start; ++i) {
+		free_blocks += refs[i] == 0;
+	}
+	printf("%llu disk blocks free\n", (unsigned long long)free_blocks);
+	for(auto &message : errors) {
+		fprintf(stderr, "%s\n", message.c_str());
+	}
+}
+
+void Inspector::print_report() const {
+	printf("%s: %u blocks of %u bytes", description.c_str(), disk_blocks, FS_BLOCKSIZE);
+	if(log_start < disk_blocks) {
+		printf(", last %u in the write-ahead log", disk_blocks - log_start);
+	}
+	printf("\n");
+	if(log_start < disk_blocks) {
+		printf("  (changes still in the log are not shown; starting the server replays them)\n");
+	}
+
+	//The allocation the server rebuilds: referenced blocks are in use
+	uint64_t used[4] = {}, shared = 0, extra_refs = 0;
+	uint64_t free_extents = 0, largest_free = 0, run = 0;
+	for(uint32_t i = 0; i < log_start; ++i) {
+		used[kinds[i]]++;
+		if(refs[i] > 1 && kinds[i] == BLOCK_DATA) {
+			shared++;
+			extra_refs += refs[i] - 1;
+		}
+		if(refs[i] == 0) {
+			free_extents += run++ == 0;
+			largest_free = std::max(largest_free, run);
+		}
+		else {
+			run = 0;
+		}
+	}
+	printf("\nallocation\n");
+	printf("  inode blocks        %llu\n", (unsigned long long)used[BLOCK_INODE]);
+	printf("  directory blocks    %llu\n", (unsigned long long)used[BLOCK_DIRECTORY]);
+	printf("  data blocks         %llu (%llu shared by copies, saving %llu)\n",
+	       (unsigned long long)used[BLOCK_DATA], (unsigned long long)shared, (unsigned long long)extra_refs);
+	printf("  free blocks         %llu in %llu runs, largest %llu\n",
+	       (unsigned long long)used[BLOCK_FREE], (unsigned long long)free_extents, (unsigned long long)largest_free);
+
+	const Inspect_stats &s = totals;
+	printf("\nfiles\n");
+	printf("  files               %llu (%llu inline)\n", (unsigned long long)s.files, (unsigned long long)s.inline_files);
+	printf("  data blocks         %llu, %llu holes\n", (unsigned long long)s.file_blocks, (unsigned long long)s.holes);
+	printf("  extents             %llu, %.2f per file with blocks\n", (unsigned long long)s.extents,
+	       s.files_with_blocks ? (double)s.extents / s.files_with_blocks : 0.0);
+	printf("  contiguous files    %llu\n", (unsigned long long)s.contiguous_files);
+	if(s.worst_extents > 1) {
+		printf("  most fragmented     %s (%llu extents)\n", s.worst_file.c_str(), (unsigned long long)s.worst_extents);
+	}
+
+	printf("\ndirectories\n");
+	printf("  directories         %llu, %llu blocks, %llu entries\n", (unsigned long long)s.directories,
+	       (unsigned long long)s.dir_blocks, (unsigned long long)s.dir_entries);
+	printf("  fill                %.1f%% of entries used\n",
+	       s.dir_blocks ? 100.0 * s.dir_entries / (s.dir_blocks * FS_DIRENTRIES) : 0.0);
+	printf("  filled <25%% %llu  <50%% %llu  <75%% %llu  >=75%% %llu\n",
+	       (unsigned long long)s.fill_histogram[0], (unsigned long long)s.fill_histogram[1],
+	       (unsigned long long)s.fill_histogram[2], (unsigned long long)s.fill_histogram[3]);
+	printf("  compactable         %llu (entries would fit in fewer blocks)\n", (unsigned long long)s.compactable_dirs);
+
+	printf("\nusers\n");
+	printf("  %-12s %8s %8s %10s %10s\n", "owner", "files", "dirs", "metadata", "data");
+	for(auto &user : s.users) {
+		printf("  %-12s %8llu %8llu %10llu %10llu\n", user.first.empty() ? "(root)" : user.first.c_str(),
+		       (unsigned long long)user.second.files, (unsigned long long)user.second.directories,
+		       (unsigned long long)user.second.metadata_blocks, (unsigned long long)user.second.data_blocks);
+	}
+
+	printf("\n%zu errors\n", errors.size());
+	for(auto &message : errors) {
+		printf("  %s\n", message.c_str());
+	}
+}
+
+int main(int argc, char *argv[]) {
+	bool tree = false, usage = false;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	int opt;
+	while((opt = getopt(argc, argv, "st:")) != -1) {
+		if(opt == 's') {
+			tree = true;
+		}
+		else if(opt == 't' && atoi(optarg) > 0) {
+			threads = atoi(optarg);
+		}
+		else {
+			usage = true;
+		}
+	}
+	if(usage || argc - optind > 1) {
+		fprintf(stderr, "Usage: %s [-s] [-t threads] [disk]\n", argv[0]);
+		return 1;
+	}
+
+	std::string path;
+	const char *image = getenv("FS_DISK");
+	const char *user = getenv("USER");
+	if(optind < argc) {
+		path = argv[optind];
+	}
+	else if(image != nullptr && *image != '\0') {
+		path = image;
+	}
+	else {
+		path = std::string("/tmp/fs_tmp.") + (user ? user : "") + ".disk";
+	}
+
+	Inspector inspector;
+	if(!inspector.open(path.c_str())) {
+		return 1;
+	}
+	inspector.walk(threads);
+	if(tree) {
+		inspector.print_tree();
+	}
+	else {
+		inspector.print_report();
+	}
+	return inspector.has_errors() ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+#include "fs_iosched.h"
+#include "fs_server.h"
+
+#include <sys/uio.h>		// preadv(), pwritev()
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+
+//Most blocks done in one transfer
+static const unsigned int MAX_MERGE = 64;
+
+//One block I/O, on the stack of the thread waiting for it
+struct Io_request {
+	off_t offset;
+	char *buf;
+	bool write;
+	std::chrono::steady_clock::time_point deadline;
+	bool taken = false;			//part of a transfer
+	bool done = false;
+	std::condition_variable wake;		//done, or a transfer may be started
+	Io_request *prev = nullptr;		//arrival order while waiting
+	Io_request *next = nullptr;
+};
+
+static bool by_offset(const Io_request *a, const Io_request *b) {
+	return a->offset < b->offset;
+}
+
+Io_queue::Io_queue(int image_fd, unsigned int deadline_ms, unsigned int depth)
+	: fd(image_fd), deadline(std::chrono::milliseconds(deadline_ms)), depth(std::max(depth, 1u)) {}
+
+void Io_queue::transfer(off_t offset, void *buf, bool write) {
+	Io_request request;
+	request.offset = offset;
+	request.buf = (char *)buf;
+	request.write = write;
+	request.deadline = std::chrono::steady_clock::now() + deadline;
+
+	std::unique_lock<std::mutex> lck(lock);
+	//After any I/Os for the same offset, so they go in arrival order
+	sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), &request, by_offset), &request);
+	request.prev = newest;
+	(newest ? newest->next : oldest) = &request;
+	newest = &request;
+
+	while(!request.done) {
+		if(!request.taken && in_flight < depth) {
+			run_transfer(lck);
+		}
+		else {
+			request.wake.wait(lck);
+		}
+	}
+}
+
+/*	-Called with lock held, which is dropped during the transfer-
+	Takes the next run of I/Os off the queue and does them			*/
+void Io_queue::run_transfer(std::unique_lock<std::mutex> &lck) {
+	//The oldest I/O if it is overdue, else the next one up from the head
+	auto first = sorted.end();
+	if(oldest->deadline <= std::chrono::steady_clock::now()) {
+		first = std::lower_bound(sorted.begin(), sorted.end(), oldest, by_offset);
+		while(*first != oldest) {
+			++first;
+		}
+	}
+	else {
+		first = std::lower_bound(sorted.begin(), sorted.end(), head,
+			[](const Io_request *request, off_t offset) { return request->offset < offset; });
+		if(first == sorted.end()) {
+			first = sorted.begin();
+		}
+	}
+
+	//Each following I/O the same way for the next block joins the run; a
+	//second I/O for the same block waits for the next transfer
+	auto last = first + 1;
+	while(last != sorted.end() && last - first < MAX_MERGE && (*last)->write == (*first)->write &&
+	      (*last)->offset == (*(last - 1))->offset + FS_BLOCKSIZE) {
+		++last;
+	}
+
+	Io_request *run[MAX_MERGE];
+	struct iovec iov[MAX_MERGE];
+	int count = last - first;
+	for(int i = 0; i < count; ++i) {
+		Io_request *request = first[i];
+		run[i] = request;
+		iov[i].iov_base = request->buf;
+		iov[i].iov_len = FS_BLOCKSIZE;
+		request->taken = true;
+		(request->prev ? request->prev->next : oldest) = request->next;
+		(request->next ? request->next->prev : newest) = request->prev;
+	}
+	sorted.erase(first, last);
+	bool write = run[0]->write;
+	off_t offset = run[0]->offset;
+	head = offset + (off_t)count * FS_BLOCKSIZE;
+	in_flight++;
+	//Another transfer may start alongside this one
+	wake_dispatcher();
+	lck.unlock();
+
+	//Picks up where a short transfer stopped
+	int next_iov = 0;
+	while(next_iov < count) {
+		ssize_t moved = write ? pwritev(fd, iov + next_iov, count - next_iov, offset)
+				      : preadv(fd, iov + next_iov, count - next_iov, offset);
+		assert(moved > 0);
+		if(moved <= 0) {
+			break;
+		}
+		offset += moved;
+		while(next_iov < count && moved >= (ssize_t)iov[next_iov].iov_len) {
+			moved -= iov[next_iov].iov_len;
+			next_iov++;
+		}
+		if(moved > 0) {
+			iov[next_iov].iov_base = (char *)iov[next_iov].iov_base + moved;
+			iov[next_iov].iov_len -= moved;
+		}
+	}
+
+	lck.lock();
+	in_flight--;
+	for(int i = 0; i < count; ++i) {
+		run[i]->done = true;
+		run[i]->wake.notify_one();
+	}
+	wake_dispatcher();
+}
+
+//Lets the longest waiting thread start a transfer if there is room for one
+void Io_queue::wake_dispatcher() {
+	if(oldest && in_flight < depth) {
+		oldest->wake.notify_one();
+	}
+}
@@ -0,0 +1,58 @@
+/*
+ * fs_iosched.h
+ *
+ * I/O scheduler for disk images.  Instead of each request thread calling
+ * pread()/pwrite() for its own block as it comes, block I/Os wait in a
+ * queue per image kept sorted by offset.  They are taken off in elevator
+ * order (upwards from the end of the last transfer, then round again from
+ * the lowest), each with the waiting I/Os in the same direction for the
+ * blocks right after it, and done as one preadv()/pwritev().  An I/O that
+ * has waited past its deadline goes next whatever its offset, so a busy
+ * stretch of the disk cannot starve the rest.
+ *
+ * There is no scheduler thread: a transfer is done by one of the request
+ * threads waiting in the queue, for its own I/O and whatever was merged
+ * with it, with at most depth transfers in flight on one image.
+ */
+
+#ifndef _FS_IOSCHED_H_
+#define _FS_IOSCHED_H_
+
+#include <sys/types.h>		// off_t
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+struct Io_request;
+
+class Io_queue
+{
+	public:
+		//deadline_ms: longest an I/O waits before it is taken out of turn
+		//depth: transfers in flight at once
+		Io_queue(int image_fd, unsigned int deadline_ms, unsigned int depth);
+		Io_queue(const Io_queue &) = delete;
+		Io_queue &operator=(const Io_queue &) = delete;
+
+		//Reads or writes FS_BLOCKSIZE bytes at offset through the queue,
+		//returning once they are done
+		void transfer(off_t offset, void *buf, bool write);
+
+	private:
+		int fd;
+		std::chrono::steady_clock::duration deadline;
+		unsigned int depth;
+
+		std::mutex lock;			//guards everything below and every queued Io_request
+		std::vector<Io_request *> sorted;	//waiting I/Os by offset
+		Io_request *oldest = nullptr;		//waiting I/Os in arrival order
+		Io_request *newest = nullptr;
+		off_t head = 0;				//end of the last transfer taken
+		unsigned int in_flight = 0;
+
+		void run_transfer(std::unique_lock<std::mutex> &lck);
+		void wake_dispatcher();
+};
+
+#endif /* _FS_IOSCHED_H_ */
@@ -0,0 +1,187 @@
+#include "fs_lease.h"
+#include "fs_socket.h"
+#include "fs_filesystem.h"
+#include "helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef std::chrono::steady_clock Lease_clock;
+
+//A connection that sent FS_LEASES
+struct Lease_holder {
+	int fd;
+	uint64_t sent = 0;		//sequence of the last recall sent
+	uint64_t answered = 0;		//sequence of the last recall answered
+	bool gone = false;		//the connection closed or broke
+};
+
+struct Lease {
+	std::shared_ptr<Lease_holder> holder;
+	Lease_clock::time_point expires;
+	std::string name;		//"<username> <pathname>", as sent in recalls
+};
+
+//Grants between sweeps of expired leases out of the table
+static const unsigned int SWEEP_GRANTS = 4096;
+
+static unsigned int lease_ms = 0;		//0 while leases are off
+
+static std::mutex lease_lock;			//guards everything below and every holder
+static std::condition_variable recall_answered;
+static std::unordered_map<uint64_t, std::shared_ptr<Lease_holder>> holders;
+static uint64_t next_holder = 1;
+static std::unordered_map<uint32_t, std::vector<Lease>> leases;	//by inode block
+static unsigned int grants_since_sweep = 0;
+
+//Files in leases, so writes to a server without leases skip lease_lock
+static std::atomic<size_t> leased_files(0);
+
+void init_leases(bool follower) {
+	long ms = env_option("FS_LEASE_MS", 1000);
+	lease_ms = (follower || ms <= 0) ? 0 : ms;
+}
+
+void serve_lease_holder(int connectionfd) {
+	if(lease_ms == 0) {
+		send(connectionfd, ERROR_RESPONSE, sizeof(ERROR_RESPONSE), MSG_NOSIGNAL);
+		return;
+	}
+	auto holder = std::make_shared<Lease_holder>();
+	holder->fd = connectionfd;
+	uint64_t id;
+	{
+		Lock_RAII lease_mutex(&lease_lock);
+		id = next_holder++;
+		holders[id] = holder;
+	}
+	std::string reply = "FS_LEASES " + std::to_string(id) + " " + std::to_string(lease_ms);
+	bool ok = send(connectionfd, reply.c_str(), reply.size() + 1, MSG_NOSIGNAL) == (ssize_t)(reply.size() + 1);
+	printf("Lease holder %lu on connection %d\n", (unsigned long)id, connectionfd);
+
+	//All the holder sends from now on are answers to recalls
+	char msg[MAX_MESSAGE_SIZE + 1];
+	while(ok) {
+		memset(msg, 0, sizeof(msg));
+		size_t recvd = receiveBytes(msg, connectionfd, false);
+		unsigned long sequence;
+		char extra;
+		if(recvd == 0 || recvd == MAX_MESSAGE_SIZE + 1 ||
+		   sscanf(msg, "FS_RECALLED %lu%c", &sequence, &extra) != 1) {
+			break;
+		}
+		Lock_RAII lease_mutex(&lease_lock);
+		holder->answered = std::max<uint64_t>(holder->answered, sequence);
+		recall_answered.notify_all();
+	}
+
+	//Its leases stay in the table and are waited out, since the client
+	//may not have noticed the connection is gone
+	Lock_RAII lease_mutex(&lease_lock);
+	holder->gone = true;
+	holders.erase(id);
+	printf("Lease holder %lu gone\n", (unsigned long)id);
+}
+
+//Drops expired leases from the table, called with lease_lock held
+static void sweep_leases(Lease_clock::time_point now) {
+	for(auto file = leases.begin(); file != leases.end();) {
+		std::vector<Lease> &held = file->second;
+		held.erase(std::remove_if(held.begin(), held.end(),
+			[now](const Lease &lease) { return lease.expires <= now; }), held.end());
+		file = held.empty() ? leases.erase(file) : std::next(file);
+	}
+	leased_files = leases.size();
+}
+
+bool grant_lease(uint32_t inode, uint64_t holder, std::string_view username, std::string_view pathname) {
+	if(lease_ms == 0) {
+		return false;
+	}
+	Lease_clock::time_point now = Lease_clock::now();
+	Lock_RAII lease_mutex(&lease_lock);
+	auto found = holders.find(holder);
+	if(found == holders.end()) {
+		return false;
+	}
+	if(++grants_since_sweep >= SWEEP_GRANTS) {
+		sweep_leases(now);
+		grants_since_sweep = 0;
+	}
+
+	//A file has one lease per holder, renewed by every read
+	Lease_clock::time_point expires = now + std::chrono::milliseconds(lease_ms);
+	std::vector<Lease> &held = leases[inode];
+	for(Lease &lease : held) {
+		if(lease.holder == found->second) {
+			lease.expires = expires;
+			return true;
+		}
+	}
+	std::string name;
+	name.reserve(username.size() + 1 + pathname.size());
+	name.append(username).append(" ").append(pathname);
+	held.push_back({found->second, expires, std::move(name)});
+	leased_files = leases.size();
+	return true;
+}
+
+void recall_leases(const uint32_t blocks[], size_t count) {
+	if(leased_files.load() == 0) {
+		return;
+	}
+	std::unique_lock<std::mutex> lck(lease_lock);
+	std::vector<Lease> recalled;
+	for(size_t i = 0; i < count; ++i) {
+		auto file = leases.find(blocks[i]);
+		if(file != leases.end()) {
+			std::move(file->second.begin(), file->second.end(), std::back_inserter(recalled));
+			leases.erase(file);
+		}
+	}
+	leased_files = leases.size();
+	if(recalled.empty()) {
+		return;
+	}
+
+	//Recalls are sent without blocking, so lease_lock is never held
+	//waiting on a client.  A holder whose connection cannot take a whole
+	//recall is cut off and its lease waited out.
+	Lease_clock::time_point now = Lease_clock::now();
+	std::vector<uint64_t> sequences(recalled.size(), 0);
+	for(size_t i = 0; i < recalled.size(); ++i) {
+		Lease &lease = recalled[i];
+		Lease_holder &holder = *lease.holder;
+		if(lease.expires <= now || holder.gone) {
+			continue;
+		}
+		std::string recall = "FS_RECALL " + std::to_string(holder.sent + 1) + " " + lease.name;
+		if(send(holder.fd, recall.c_str(), recall.size() + 1, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)(recall.size() + 1)) {
+			sequences[i] = ++holder.sent;
+		}
+		else {
+			holder.gone = true;
+			shutdown(holder.fd, SHUT_RDWR);
+		}
+	}
+
+	for(size_t i = 0; i < recalled.size(); ++i) {
+		Lease &lease = recalled[i];
+		uint64_t sequence = sequences[i];
+		recall_answered.wait_until(lck, lease.expires, [&lease, sequence] {
+			return sequence != 0 && lease.holder->answered >= sequence;
+		});
+	}
+}
@@ -0,0 +1,55 @@
+/*
+ * fs_lease.h
+ *
+ * Read leases for client-side caches.  A client that caches blocks opens
+ * one extra connection and sends "FS_LEASES", making it a lease holder;
+ * the server answers "FS_LEASES <holder> <lease_ms>" and from then on
+ * sends recalls down that connection.  Reads sent as
+ *	FS_LEASEBLOCK <username> <pathname> <block> <holder>
+ * are answered like FS_READBLOCK and also lease the whole file to the
+ * holder for lease_ms, counted from when the server read it.
+ *
+ * Before a file is written or deleted, each unexpired lease on it is
+ * recalled with "FS_RECALL <sequence> <username> <pathname>", which the
+ * holder answers with "FS_RECALLED <sequence>" once it has dropped the
+ * file.  The change waits (holding the file's inode lock, so no new lease
+ * is granted meanwhile) until every holder has answered or its lease has
+ * run out, so a holder that stops answering delays it by at most
+ * lease_ms.  Every message ends with its NULL.
+ */
+
+#ifndef _FS_LEASE_H_
+#define _FS_LEASE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Reads FS_LEASE_MS (default 1000, 0 turns leases off) from the
+ * environment.  A follower never grants leases, since it does not see
+ * the leader's changes before they are made.
+ */
+void init_leases(bool follower);
+
+/*
+ * Serves a connection that sent "FS_LEASES" until it closes, answering
+ * FS_ERROR if leases are off.
+ */
+void serve_lease_holder(int connectionfd);
+
+/*
+ * Leases the file whose inode is in block inode to holder, reached under
+ * username and pathname.  Must be called with the inode's lock held.
+ * Returns false if holder is not connected (or leases are off).
+ */
+bool grant_lease(uint32_t inode, uint64_t holder, std::string_view username, std::string_view pathname);
+
+/*
+ * Recalls every lease on the files whose inodes are in blocks, and waits
+ * until each is dropped or runs out.  Must be called with the inodes'
+ * locks (or the locks of directories above them) held, before they change.
+ */
+void recall_leases(const uint32_t blocks[], size_t count);
+
+#endif /* _FS_LEASE_H_ */
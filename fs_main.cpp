@@ -0,0 +1,113 @@
+#include "fs_client.h"
+#include "fs_server.h"
+#include "fs_socket.h"
+#include "fs_filesystem.h"
+#include "fs_defrag.h"
+#include "fs_admission.h"
+#include "fs_trace.h"
+#include "fs_phase.h"
+#include "fs_device.h"
+#include "fs_shm.h"
+#include "fs_timer.h"
+#include "fs_replica.h"
+#include "fs_lease.h"
+#include "helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+
+int main(int argc, const char **argv) {
+	// Parse command line arguments
+	if (argc > 2) {
+		printf("Usage: ./server port_num\n");
+		return 1;
+	}
+	int port = (argc == 2) ? atoi(argv[1]) : 0;
+
+	//Before init(), which starts the first other threads
+	init_phase_trace();
+
+	//FS_DISK: disk image made by fs_mkfs to serve instead of the disk of libfs_server.o,
+	//or the images of a striped disk separated by commas
+	const char *image = getenv("FS_DISK");
+	if (image != nullptr && *image != '\0') {
+		if (!dev_open_image(image)) {
+			return 1;
+		}
+	}
+	else if (FS_BLOCKSIZE != 512) {
+		fprintf(stderr, "The libfs_server.o disk has 512 byte blocks; set FS_DISK to an image made by fs_mkfs\n");
+		return 1;
+	}
+
+	//FS_IO_SCHED: sort and merge the I/O of the images, FS_IO_DEADLINE_MS: longest
+	//an I/O is passed over, FS_IO_DEPTH: transfers in flight on one image
+	if (env_option("FS_IO_SCHED", 0) > 0 &&
+	    !dev_schedule_io(env_option("FS_IO_DEADLINE_MS", 100), env_option("FS_IO_DEPTH", 4))) {
+		fprintf(stderr, "FS_IO_SCHED needs FS_DISK\n");
+		return 1;
+	}
+
+	//FS_REPLICATE: Unix socket to ship every change to followers through
+	//FS_FOLLOW: serve reads as a follower of the leader at this Unix socket
+	const char *leader_path = getenv("FS_REPLICATE");
+	const char *follow_path = getenv("FS_FOLLOW");
+	bool leader = leader_path != nullptr && *leader_path != '\0';
+	bool follower = follow_path != nullptr && *follow_path != '\0';
+	long defrag_ms = env_option("FS_DEFRAG_MS", 0);
+	if (follower && (leader || defrag_ms > 0 || env_option("FS_WAL_BLOCKS", 0) > 0)) {
+		fprintf(stderr, "A follower cannot also lead, defragment or keep a log\n");
+		return 1;
+	}
+
+	init();
+
+	//FS_DEFRAG_MS: pause between defragmenter steps, 0 (default) disables it
+	if (defrag_ms > 0) {
+		start_defrag(defrag_ms);
+	}
+
+	if (leader && !start_leader(leader_path)) {
+		return 1;
+	}
+	//FS_MAX_STALENESS_MS: how far behind the leader a follower may answer reads
+	if (follower) {
+		start_follower(follow_path, env_option("FS_MAX_STALENESS_MS", 1000));
+	}
+
+	//FS_LEASE_MS: how long a client may cache what it reads, 0 for never
+	init_leases(follower);
+	init_admission();
+	init_timeouts();
+
+	//FS_TRACE: file to record every request to, for fs_replay
+	const char *trace_path = getenv("FS_TRACE");
+	if (trace_path != nullptr && *trace_path != '\0' && !start_trace(trace_path)) {
+		return 1;
+	}
+
+	//FS_SHM: shared memory object (e.g. /fs.alice) for clients on this host
+	const char *shm_name = getenv("FS_SHM");
+	if (shm_name != nullptr && *shm_name != '\0' && !start_shm(shm_name)) {
+		return 1;
+	}
+
+	//FS_LISTEN_BACKLOG: listen() queue size, FS_MAX_CONNECTIONS: connections served at once
+	long backlog = env_option("FS_LISTEN_BACKLOG", 30);
+	long max_connections = env_option("FS_MAX_CONNECTIONS", 1024);
+
+	//FS_ACCEPTORS: accept loops on SO_REUSEPORT sockets, 0 for one per core
+	long acceptors = env_option("FS_ACCEPTORS", 1);
+	if (acceptors <= 0) {
+		acceptors = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	//calls driver function that runs indefinitely
+	if (run_server(port, backlog, max_connections, acceptors) == -1) {
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+/*
+ * fs_mkfs
+ *
+ * Formats a disk image for the file server (served with FS_DISK=<image>),
+ * like createfs does for the disk of libfs_server.o: an empty root
+ * directory in block 0 and every other block free.  The image uses the
+ * block size fs_mkfs was built with.
+ *
+ * Given several images separated by commas, formats them as one disk
+ * striped across them (served with the same list in FS_DISK).
+ *
+ * Usage: fs_mkfs [-u stripe_blocks] <image>[,<image>...] <blocks>
+ *	-u stripe_blocks	blocks in a row on one image of a stripe set (default 16)
+ */
+
+#include "fs_server.h"
+#include "fs_device.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+	long stripe_blocks = 16;
+	int opt;
+	while((opt = getopt(argc, argv, "u:")) != -1) {
+		stripe_blocks = (opt == 'u') ? atol(optarg) : 0;
+	}
+	long blocks = (argc - optind == 2) ? atol(argv[optind + 1]) : 0;
+	if(argc - optind != 2 || blocks < 2 || blocks > 0x7fffffffL || stripe_blocks < 1 || stripe_blocks > 0x7fffffffL) {
+		fprintf(stderr, "Usage: %s [-u stripe_blocks] <image>[,<image>...] <blocks>\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<std::string> paths;
+	std::string list(argv[optind]);
+	for(size_t start = 0, end; start <= list.size(); start = end + 1) {
+		end = std::min(list.find(',', start), list.size());
+		paths.push_back(list.substr(start, end - start));
+	}
+	uint32_t members = paths.size();
+	if(members == 1) {
+		stripe_blocks = 1;
+	}
+	//Every image gets room for the same whole number of stripes
+	long stripes = (blocks + stripe_blocks - 1) / stripe_blocks;
+	long member_blocks = (stripes + members - 1) / members * stripe_blocks;
+
+	Dev_superblock super;
+	memset(&super, 0, sizeof(super));
+	memcpy(super.magic, DEV_IMAGE_MAGIC, sizeof(super.magic));
+	super.block_size = FS_BLOCKSIZE;
+	super.disk_blocks = blocks;
+	if(members > 1) {
+		super.members = members;
+		super.stripe_blocks = stripe_blocks;
+		super.set_id = std::random_device()();
+	}
+
+	//Block 0, the root, is the first block of image 0
+	uint32_t root_member;
+	uint32_t root_block = dev_stripe_block(0, members, stripe_blocks, root_member);
+
+	for(uint32_t i = 0; i < members; ++i) {
+		const char *path = paths[i].c_str();
+		int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fd == -1) {
+			perror(path);
+			return 1;
+		}
+
+		std::vector<char> block(FS_BLOCKSIZE, 0);
+		super.member = i;
+		memcpy(block.data(), &super, sizeof(super));
+		bool ok = pwrite(fd, block.data(), FS_BLOCKSIZE, 0) == FS_BLOCKSIZE;
+
+		if(i == root_member) {
+			std::fill(block.begin(), block.end(), 0);
+			fs_inode root;
+			memset(&root, 0, sizeof(root));
+			root.type = 'd';
+			memcpy(block.data(), &root, sizeof(root));
+			ok = ok && pwrite(fd, block.data(), FS_BLOCKSIZE, (off_t)(root_block + 1) * FS_BLOCKSIZE) == FS_BLOCKSIZE;
+		}
+
+		//The remaining blocks read as zeros without being written
+		ok = ok && ftruncate(fd, (off_t)(member_blocks + 1) * FS_BLOCKSIZE) == 0;
+		if(!ok || close(fd) != 0) {
+			perror(path);
+			return 1;
+		}
+	}
+	if(members == 1) {
+		printf("%s: %ld blocks of %u bytes\n", paths[0].c_str(), blocks, FS_BLOCKSIZE);
+	}
+	else {
+		printf("%s: %ld blocks of %u bytes, striped %ld blocks at a time across %u images\n",
+		       argv[optind], blocks, FS_BLOCKSIZE, stripe_blocks, members);
+	}
+	return 0;
+}
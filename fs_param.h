@@ -11,17 +11,6 @@
  * File system parameters
  */
 
-/*
- * Size of a disk block (in bytes)
- */
-static const unsigned int FS_BLOCKSIZE = 512;
-
-/*
- * Maximum # of data blocks in a file or directory.  Computed so that
- * an inode is exactly 1 block.
- */
-static const unsigned int FS_MAXFILEBLOCKS = 124;
-
 /*
  * Maximum length of a file or directory name, not including the null terminator
  */
@@ -37,4 +26,24 @@ static const unsigned int FS_MAXPATHNAME = 128;
  */
 static const unsigned int FS_MAXUSERNAME = 10;
 
+/*
+ * Size of a disk block (in bytes).  Chosen when building (make BLOCK_SIZE=n);
+ * clients and the server must be built with the same size, and a server
+ * only serves disks formatted with it.
+ */
+#ifndef FS_BLOCK_SIZE
+#define FS_BLOCK_SIZE 512
+#endif
+static const unsigned int FS_BLOCKSIZE = FS_BLOCK_SIZE;
+static_assert(FS_BLOCKSIZE >= 512 && FS_BLOCKSIZE % 16 == 0,
+              "blocks are a multiple of 16 bytes, at least 512");
+
+/*
+ * Maximum # of data blocks in a file or directory.  Computed so that
+ * an inode is exactly 1 block: a type, an owner and a size come first.
+ * (124 for 512 byte blocks.)
+ */
+static const unsigned int FS_MAXFILEBLOCKS =
+    (FS_BLOCKSIZE - 1 - (FS_MAXUSERNAME + 1) - 4) / 4;
+
 #endif /* _FS_PARAM_H_ */
@@ -0,0 +1,178 @@
+#include "fs_phase.h"
+#include "helpers.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+thread_local bool phase_sampled = false;
+
+//Spans kept per buffer; older ones are overwritten
+static const size_t PHASE_BUFFER_SPANS = 4096;
+
+struct Phase_span {
+	const char *name;
+	uint64_t start_ns;
+	uint64_t end_ns;
+	uint64_t request;
+};
+
+/*
+	A ring of recent spans.  A buffer belongs to one thread at a time and
+	is handed to the next new thread when its owner exits, so short-lived
+	connection threads do not each leave a buffer behind.  The lock is
+	only ever contended by the exporter.
+*/
+struct Phase_buffer {
+	std::mutex lock;
+	unsigned int tid;
+	std::vector<Phase_span> spans;
+	size_t next = 0;
+};
+
+static unsigned int sample_every = 0;
+static std::string phase_file;
+static uint64_t clock_origin;
+static std::atomic<uint64_t> request_count(0);
+
+static std::mutex buffers_lock;
+static std::vector<std::unique_ptr<Phase_buffer>> buffers;
+static std::vector<Phase_buffer*> idle_buffers;
+
+//This thread's buffer and sampled request, returned when the thread exits
+struct Phase_thread {
+	Phase_buffer *buffer = nullptr;
+	uint64_t request = 0;
+	~Phase_thread() {
+		if(buffer != nullptr) {
+			std::lock_guard<std::mutex> lck(buffers_lock);
+			idle_buffers.push_back(buffer);
+		}
+	}
+};
+static thread_local Phase_thread phase_thread;
+
+static Phase_buffer *take_buffer() {
+	std::lock_guard<std::mutex> lck(buffers_lock);
+	if(!idle_buffers.empty()) {
+		Phase_buffer *buffer = idle_buffers.back();
+		idle_buffers.pop_back();
+		return buffer;
+	}
+	buffers.emplace_back(new Phase_buffer);
+	Phase_buffer *buffer = buffers.back().get();
+	buffer->tid = buffers.size();
+	buffer->spans.resize(PHASE_BUFFER_SPANS);
+	return buffer;
+}
+
+void phase_record(const char *name, uint64_t start_ns, uint64_t end_ns) {
+	if(phase_thread.buffer == nullptr) {
+		phase_thread.buffer = take_buffer();
+	}
+	Phase_buffer &buffer = *phase_thread.buffer;
+	std::lock_guard<std::mutex> lck(buffer.lock);
+	buffer.spans[buffer.next % PHASE_BUFFER_SPANS] = {name, start_ns, end_ns, phase_thread.request};
+	buffer.next++;
+}
+
+//Names a request's span after its command, without copying the string
+static const char *command_name(const char msg[]) {
+	static const char *const commands[] = {
+		"FS_READBLOCK", "FS_WRITEBLOCK", "FS_CREATE", "FS_DELETE_TREE", "FS_DELETE", "FS_COPY"
+	};
+	for(const char *command : commands) {
+		size_t len = strlen(command);
+		if(strncmp(msg, command, len) == 0 && msg[len] == ' ') {
+			return command;
+		}
+	}
+	return "request";
+}
+
+Phase_request::Phase_request(const char msg[]) {
+	start = 0;
+	if(sample_every == 0) {
+		return;
+	}
+	uint64_t number = request_count++;
+	if(number % sample_every != 0) {
+		return;
+	}
+	phase_thread.request = number;
+	phase_sampled = true;
+	name = command_name(msg);
+	start = phase_clock();
+}
+
+Phase_request::~Phase_request() {
+	if(start != 0) {
+		phase_record(name, start, phase_clock());
+		phase_sampled = false;
+	}
+}
+
+//Writes every buffered span to phase_file as trace-event JSON
+static void export_spans() {
+	FILE *out = fopen(phase_file.c_str(), "w");
+	if(out == nullptr) {
+		perror(phase_file.c_str());
+		return;
+	}
+	size_t count = 0;
+	fprintf(out, "{\"traceEvents\":[\n");
+	std::lock_guard<std::mutex> lck(buffers_lock);
+	for(const std::unique_ptr<Phase_buffer> &buffer : buffers) {
+		std::lock_guard<std::mutex> buffer_lck(buffer->lock);
+		size_t first = buffer->next > PHASE_BUFFER_SPANS ? buffer->next - PHASE_BUFFER_SPANS : 0;
+		for(size_t i = first; i < buffer->next; ++i) {
+			const Phase_span &span = buffer->spans[i % PHASE_BUFFER_SPANS];
+			fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"fs\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+			        "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"request\":%llu}}",
+			        count++ == 0 ? "" : ",\n", span.name, buffer->tid,
+			        (span.start_ns - clock_origin) / 1000.0, (span.end_ns - span.start_ns) / 1000.0,
+			        (unsigned long long)span.request);
+		}
+	}
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	fprintf(stderr, "phases: wrote %zu spans to %s\n", count, phase_file.c_str());
+}
+
+//Exports the spans each time SIGUSR1 arrives
+static void export_loop(sigset_t signals) {
+	while(true) {
+		int signal;
+		if(sigwait(&signals, &signal) == 0) {
+			export_spans();
+		}
+	}
+}
+
+void init_phase_trace() {
+	//FS_PHASE_SAMPLE: trace one request in this many, 0 (default) disables tracing
+	long sample = env_option("FS_PHASE_SAMPLE", 0);
+	if(sample <= 0) {
+		return;
+	}
+	sample_every = sample;
+	const char *file = getenv("FS_PHASE_FILE");
+	phase_file = (file != nullptr && *file != '\0') ? file : "fs_phases.json";
+	clock_origin = phase_clock();
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	std::thread exporter(export_loop, signals);
+	exporter.detach();
+}
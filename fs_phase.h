@@ -0,0 +1,79 @@
+/*
+ * fs_phase.h
+ *
+ * Sampled per-request phase tracing.  One request in FS_PHASE_SAMPLE has
+ * each phase (parsing, admission, inode lock waits, disk I/O, send, ...)
+ * timed and kept in a buffer of the thread serving it.  On SIGUSR1 the
+ * buffered spans are written to FS_PHASE_FILE as Chrome trace-event JSON,
+ * which chrome://tracing and Perfetto show as a timeline per thread.
+ */
+
+#ifndef _FS_PHASE_H_
+#define _FS_PHASE_H_
+
+#include <cstdint>
+#include <ctime>
+
+//True while this thread serves a request that is being traced
+extern thread_local bool phase_sampled;
+
+/*
+ * Reads FS_PHASE_SAMPLE and FS_PHASE_FILE and, if tracing is on, starts the
+ * thread that writes the spans out on SIGUSR1.  Must be called before any
+ * other thread is started, so that they all leave SIGUSR1 to that thread.
+ */
+void init_phase_trace();
+
+//Nanoseconds on the monotonic clock
+inline uint64_t phase_clock() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//Adds a finished span to this thread's buffer.  name must be a literal.
+void phase_record(const char *name, uint64_t start_ns, uint64_t end_ns);
+
+/*
+ * Times the enclosing scope as one phase of the current request.  Does
+ * nothing, not even read the clock, unless the request is sampled.
+ */
+class Phase_RAII
+{
+	public:
+		Phase_RAII(const char *phase_name)
+		{
+			name = phase_name;
+			start = phase_sampled ? phase_clock() : 0;
+		}
+		Phase_RAII(const Phase_RAII &) = delete;
+		Phase_RAII &operator=(const Phase_RAII &) = delete;
+		~Phase_RAII()
+		{
+			if(start != 0 && phase_sampled) {
+				phase_record(name, start, phase_clock());
+			}
+		}
+	private:
+		const char *name;
+		uint64_t start;
+};
+
+/*
+ * Covers one request from the arrival of its request string until its
+ * response is sent, and decides whether the request is sampled.
+ * msg: the request string, which names the span after its command
+ */
+class Phase_request
+{
+	public:
+		Phase_request(const char msg[]);
+		Phase_request(const Phase_request &) = delete;
+		Phase_request &operator=(const Phase_request &) = delete;
+		~Phase_request();
+	private:
+		const char *name;
+		uint64_t start;
+};
+
+#endif /* _FS_PHASE_H_ */
@@ -0,0 +1,278 @@
+/*
+ * fs_replay
+ *
+ * Replays a trace recorded with FS_TRACE against a file server, which
+ * should start from the same file system the trace was recorded on
+ * (e.g. fresh createfs output).  Requests are sent at their original
+ * times, or with -f as fast as the server takes them.  Write data is not
+ * in the trace, so writes send a fixed non-zero block.
+ *
+ * A request is held back until every earlier request on the same path, or
+ * on a directory above it or a path below it, has finished (unless both
+ * only read), so the server sees dependent requests in trace order and the
+ * replay gives the same results every time.
+ *
+ * Usage: fs_replay [-f] [-w window] <trace> <server> <port>
+ *	-f		do not wait between requests
+ *	-w window	requests in flight at once (default 64)
+ */
+
+#include "fs_client.h"
+#include "fs_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//One request of the trace
+struct Replay_request {
+	Trace_record record;
+	std::string username;
+	std::string pathname;
+	std::string dest;
+};
+
+//Outcome of the replay, filled in by the client library's threads
+struct Replay_results {
+	std::mutex lock;
+	std::condition_variable done_cv;
+	std::vector<const Replay_request *> in_flight;
+	std::deque<const Replay_request *> waiting;	//held back by an earlier request, in trace order
+	uint64_t completed = 0;
+	uint64_t mismatched = 0;		//succeeded in one run and failed in the other
+	std::vector<uint32_t> latencies_us;
+};
+
+static bool load_trace(const char *path, std::vector<Replay_request> &requests) {
+	FILE *file = fopen(path, "rb");
+	if(file == nullptr) {
+		perror(path);
+		return false;
+	}
+	char magic[sizeof(TRACE_MAGIC)];
+	if(fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+	   memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+		fprintf(stderr, "%s: not a trace file\n", path);
+		fclose(file);
+		return false;
+	}
+	Replay_request request;
+	char strings[3 * 256];
+	while(fread(&request.record, sizeof(request.record), 1, file) == 1) {
+		const Trace_record &record = request.record;
+		size_t len = record.user_len + record.path_len + record.dest_len;
+		if(fread(strings, 1, len, file) != len) {
+			break;		//cut short while the server was writing it
+		}
+		request.username.assign(strings, record.user_len);
+		request.pathname.assign(strings + record.user_len, record.path_len);
+		request.dest.assign(strings + record.user_len + record.path_len, record.dest_len);
+		requests.push_back(request);
+	}
+	fclose(file);
+
+	//Records are written as requests finish; send them in arrival order
+	std::stable_sort(requests.begin(), requests.end(),
+		[](const Replay_request &a, const Replay_request &b) {
+			return a.record.arrival_us < b.record.arrival_us;
+		});
+	return true;
+}
+
+//True if one path is the other or a directory above it
+static bool related(const std::string &a, const std::string &b) {
+	const std::string &shorter = a.size() <= b.size() ? a : b;
+	const std::string &longer = a.size() <= b.size() ? b : a;
+	return longer.compare(0, shorter.size(), shorter) == 0 &&
+	       (longer.size() == shorter.size() || longer[shorter.size()] == '/' || shorter.back() == '/');
+}
+
+//True if later must wait for earlier to finish
+static bool depends(const Replay_request &earlier, const Replay_request &later) {
+	if(earlier.record.command == TRACE_READBLOCK && later.record.command == TRACE_READBLOCK) {
+		return false;
+	}
+	const std::string *earlier_paths[] = {&earlier.pathname, &earlier.dest};
+	const std::string *later_paths[] = {&later.pathname, &later.dest};
+	for(const std::string *a : earlier_paths) {
+		for(const std::string *b : later_paths) {
+			if(!a->empty() && !b->empty() && related(*a, *b)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*	-Called with results.lock held-
+	Moves the waiting requests that nothing earlier holds back to
+	in_flight, and returns them for the caller to issue once it has let
+	go of the lock									*/
+static std::vector<const Replay_request *> take_ready(Replay_results &results) {
+	std::vector<const Replay_request *> ready;
+	for(auto next = results.waiting.begin(); next != results.waiting.end();) {
+		const Replay_request &request = **next;
+		bool held = std::any_of(results.in_flight.begin(), results.in_flight.end(),
+			[&request](const Replay_request *other) { return depends(*other, request); }) ||
+			std::any_of(results.waiting.begin(), next,
+			[&request](const Replay_request *other) { return depends(*other, request); });
+		if(held) {
+			++next;
+			continue;
+		}
+		results.in_flight.push_back(&request);
+		ready.push_back(&request);
+		next = results.waiting.erase(next);
+	}
+	return ready;
+}
+
+static void issue(const Replay_request &request, Replay_results &results);
+
+static void finish(Replay_results &results, const Replay_request &request,
+                   std::chrono::steady_clock::time_point sent, int status) {
+	uint32_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - sent).count();
+	std::vector<const Replay_request *> ready;
+	{
+		std::lock_guard<std::mutex> lck(results.lock);
+		results.in_flight.erase(std::find(results.in_flight.begin(), results.in_flight.end(), &request));
+		results.completed++;
+		if((status == 0) != (request.record.result == TRACE_OK)) {
+			results.mismatched++;
+		}
+		results.latencies_us.push_back(latency);
+		ready = take_ready(results);
+		results.done_cv.notify_all();
+	}
+	for(const Replay_request *next : ready) {
+		issue(*next, results);
+	}
+}
+
+//Sends one request, taken into in_flight; finish() is called when it completes
+static void issue(const Replay_request &request, Replay_results &results) {
+	static const std::vector<char> write_data(FS_BLOCKSIZE, 'r');
+	const Trace_record record = request.record;
+	auto sent = std::chrono::steady_clock::now();
+	const Replay_request *issued = &request;
+	auto done = [&results, issued, sent](int status) {
+		finish(results, *issued, sent, status);
+	};
+	const char *user = request.username.c_str();
+	const char *path = request.pathname.c_str();
+
+	switch(record.command) {
+	case TRACE_READBLOCK: {
+		auto buf = std::make_shared<std::vector<char>>(FS_BLOCKSIZE);
+		fs_readblock_async(user, path, record.block, buf->data(),
+			[buf, done](int status) { done(status); });
+		break;
+	}
+	case TRACE_WRITEBLOCK:
+		fs_writeblock_async(user, path, record.block, write_data.data(), done);
+		break;
+	case TRACE_CREATE:
+		fs_create_async(user, path, record.type, done);
+		break;
+	case TRACE_DELETE:
+		fs_delete_async(user, path, done);
+		break;
+	default: {
+		//No asynchronous form of these; run them on their own thread
+		std::string username = request.username, pathname = request.pathname, dest = request.dest;
+		std::thread([username, pathname, dest, record, done] {
+			int status = (record.command == TRACE_COPY)
+				? fs_copy(username.c_str(), pathname.c_str(), dest.c_str())
+				: fs_delete_tree(username.c_str(), pathname.c_str());
+			done(status);
+		}).detach();
+	}
+	}
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double p) {
+	if(sorted.empty()) {
+		return 0;
+	}
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, char *argv[]) {
+	bool fast = false;
+	unsigned int window = 64;
+	int opt;
+	while((opt = getopt(argc, argv, "fw:")) != -1) {
+		if(opt == 'f') {
+			fast = true;
+		}
+		else if(opt == 'w' && atoi(optarg) > 0) {
+			window = atoi(optarg);
+		}
+		else {
+			optind = argc;
+			break;
+		}
+	}
+	if(argc - optind != 3) {
+		fprintf(stderr, "Usage: %s [-f] [-w window] <trace> <server> <port>\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<Replay_request> requests;
+	if(!load_trace(argv[optind], requests)) {
+		return 1;
+	}
+	if(fs_clientinit(argv[optind + 1], atoi(argv[optind + 2])) != 0) {
+		fprintf(stderr, "Cannot reach %s:%s\n", argv[optind + 1], argv[optind + 2]);
+		return 1;
+	}
+
+	Replay_results results;
+	results.latencies_us.reserve(requests.size());
+	auto start = std::chrono::steady_clock::now();
+	for(const Replay_request &request : requests) {
+		if(!fast) {
+			std::this_thread::sleep_until(start + std::chrono::microseconds(request.record.arrival_us));
+		}
+		std::vector<const Replay_request *> ready;
+		{
+			std::unique_lock<std::mutex> lck(results.lock);
+			results.done_cv.wait(lck, [&] {
+				return results.in_flight.size() + results.waiting.size() < window;
+			});
+			results.waiting.push_back(&request);
+			ready = take_ready(results);
+		}
+		for(const Replay_request *next : ready) {
+			issue(*next, results);
+		}
+	}
+	std::unique_lock<std::mutex> lck(results.lock);
+	results.done_cv.wait(lck, [&] { return results.in_flight.empty() && results.waiting.empty(); });
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<uint32_t> &latencies = results.latencies_us;
+	std::sort(latencies.begin(), latencies.end());
+	printf("%llu requests in %.3f s (%.0f/s), %llu with a different result than traced\n",
+	       (unsigned long long)results.completed, seconds,
+	       seconds > 0 ? results.completed / seconds : 0.0,
+	       (unsigned long long)results.mismatched);
+	printf("latency us: p50 %u  p90 %u  p99 %u  max %u\n",
+	       percentile(latencies, 0.5), percentile(latencies, 0.9),
+	       percentile(latencies, 0.99), percentile(latencies, 1.0));
+	return 0;
+}
@@ -0,0 +1,373 @@
+#include "fs_replica.h"
+#include "fs_server.h"
+#include "fs_filesystem.h"
+#include "fs_wal.h"
+
+#include <sys/socket.h>		// socket(), bind(), listen(), accept(), send(), recv()
+#include <sys/un.h>		// sockaddr_un
+#include <pthread.h>		// pthread_rwlock_t
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * The stream from the leader to a follower is a REPL_HELLO and then any
+ * number of REPL_BLOCKS and REPL_SYNC messages, each starting with a
+ * Repl_header.
+ */
+enum Repl_type : uint32_t {
+	REPL_HELLO = 1,			//followed by a Repl_hello
+	REPL_BLOCKS = 2,		//followed by count blocks, each its number and then its data
+	REPL_SYNC = 3,			//everything changed before sync_us has been sent
+};
+
+struct Repl_header {
+	uint32_t type;
+	uint32_t count;
+	uint64_t sync_us;
+};
+
+struct Repl_hello {
+	uint32_t block_size;
+	uint32_t disk_blocks;
+};
+
+//Longest a follower goes without a REPL_SYNC while connected
+static const unsigned int HEARTBEAT_MS = 10;
+
+//Blocks per message while copying the disk to a new follower
+static const unsigned int SNAPSHOT_BATCH = 64;
+
+//Bytes of changes a follower may have waiting before it is dropped (and
+//then has to copy the whole disk again)
+static const size_t MAX_BACKLOG = 64 << 20;
+
+//Pause before a follower tries to connect again
+static const unsigned int RETRY_MS = 100;
+
+//Wall clock, so leader and follower agree on it
+static uint64_t wall_clock_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool send_all(int fd, const void *buf, size_t size) {
+	const char *data = (const char *)buf;
+	while(size > 0) {
+		ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+		if(sent <= 0) {
+			return false;
+		}
+		data += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static bool recv_all(int fd, void *buf, size_t size) {
+	char *data = (char *)buf;
+	while(size > 0) {
+		ssize_t got = recv(fd, data, size, 0);
+		if(got <= 0) {
+			return false;
+		}
+		data += got;
+		size -= got;
+	}
+	return true;
+}
+
+static bool unix_address(const char *path, sockaddr_un &addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+	return true;
+}
+
+/*--------------------------------LEADER--------------------------------*/
+
+typedef std::shared_ptr<const std::vector<char>> Repl_message;
+
+//A connected follower, sent to by its own thread
+struct Follower {
+	int fd;
+	std::deque<Repl_message> queue;		//changes not yet sent
+	size_t queued_bytes = 0;
+	bool dropped = false;			//fell too far behind
+	std::condition_variable changed;
+};
+
+static std::atomic<bool> leading(false);
+static std::mutex repl_lock;			//guards followers and everything in them
+static std::vector<Follower *> followers;
+
+void replicate_writes(const Dev_write writes[], size_t count) {
+	if(!leading.load(std::memory_order_relaxed)) {
+		return;
+	}
+	Lock_RAII repl_mutex(&repl_lock);
+	if(followers.empty()) {
+		return;
+	}
+	auto message = std::make_shared<std::vector<char>>(sizeof(Repl_header) + count * (sizeof(uint32_t) + FS_BLOCKSIZE));
+	Repl_header header = {REPL_BLOCKS, (uint32_t)count, 0};
+	char *out = message->data();
+	memcpy(out, &header, sizeof(header));
+	out += sizeof(header);
+	for(size_t i = 0; i < count; ++i) {
+		memcpy(out, &writes[i].block, sizeof(uint32_t));
+		memcpy(out + sizeof(uint32_t), writes[i].data, FS_BLOCKSIZE);
+		out += sizeof(uint32_t) + FS_BLOCKSIZE;
+	}
+
+	for(Follower *follower : followers) {
+		if(follower->dropped) {
+			continue;
+		}
+		if(follower->queued_bytes + message->size() > MAX_BACKLOG) {
+			//Unblocks its thread if it is stuck sending
+			follower->dropped = true;
+			follower->queue.clear();
+			shutdown(follower->fd, SHUT_RDWR);
+		}
+		else {
+			follower->queue.push_back(message);
+			follower->queued_bytes += message->size();
+		}
+		follower->changed.notify_one();
+	}
+}
+
+/*
+	Sends the disk blocks outside the log.  The follower was registered
+	first, so a block changed while it is being read here is sent again
+	from the queue afterwards.
+*/
+static bool send_snapshot(int fd) {
+	uint32_t blocks = wal_first_block();
+	std::vector<char> message(sizeof(Repl_header) + SNAPSHOT_BATCH * (sizeof(uint32_t) + FS_BLOCKSIZE));
+	for(uint32_t first = 0; first < blocks; first += SNAPSHOT_BATCH) {
+		uint32_t count = std::min(SNAPSHOT_BATCH, blocks - first);
+		Repl_header header = {REPL_BLOCKS, count, 0};
+		char *out = message.data();
+		memcpy(out, &header, sizeof(header));
+		out += sizeof(header);
+		for(uint32_t block = first; block < first + count; ++block) {
+			memcpy(out, &block, sizeof(uint32_t));
+			dev_readblock(block, out + sizeof(uint32_t));
+			out += sizeof(uint32_t) + FS_BLOCKSIZE;
+		}
+		if(!send_all(fd, message.data(), out - message.data())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//Runs on its own thread for each follower until it disconnects
+static void serve_follower(Follower *follower) {
+	int fd = follower->fd;
+	Repl_header hello_header = {REPL_HELLO, 0, 0};
+	Repl_hello hello = {FS_BLOCKSIZE, fs_disksize};
+	bool ok = send_all(fd, &hello_header, sizeof(hello_header)) &&
+		  send_all(fd, &hello, sizeof(hello)) &&
+		  send_snapshot(fd);
+
+	std::unique_lock<std::mutex> lck(repl_lock);
+	while(ok && !follower->dropped) {
+		follower->changed.wait_for(lck, std::chrono::milliseconds(HEARTBEAT_MS),
+			[follower] { return !follower->queue.empty() || follower->dropped; });
+		if(follower->dropped) {
+			break;
+		}
+		//Every change made before now is in the batch or already sent
+		std::deque<Repl_message> batch;
+		batch.swap(follower->queue);
+		follower->queued_bytes = 0;
+		Repl_header sync = {REPL_SYNC, 0, wall_clock_us()};
+		lck.unlock();
+
+		for(const Repl_message &message : batch) {
+			ok = ok && send_all(fd, message->data(), message->size());
+		}
+		ok = ok && send_all(fd, &sync, sizeof(sync));
+		lck.lock();
+	}
+
+	if(follower->dropped) {
+		printf("Follower %d fell too far behind and was dropped\n", fd);
+	}
+	else {
+		printf("Follower %d disconnected\n", fd);
+	}
+	followers.erase(std::find(followers.begin(), followers.end(), follower));
+	lck.unlock();
+	close(fd);
+	delete follower;
+}
+
+static void accept_followers(int listener) {
+	while(true) {
+		int fd = accept(listener, nullptr, nullptr);
+		if(fd == -1) {
+			continue;
+		}
+		printf("Follower %d connected\n", fd);
+		Follower *follower = new Follower;
+		follower->fd = fd;
+		{
+			Lock_RAII repl_mutex(&repl_lock);
+			followers.push_back(follower);
+		}
+		std::thread(serve_follower, follower).detach();
+	}
+}
+
+bool start_leader(const char *path) {
+	sockaddr_un addr;
+	if(!unix_address(path, addr)) {
+		return false;
+	}
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path);
+	if(listener == -1 || bind(listener, (sockaddr *)&addr, sizeof(addr)) == -1 || listen(listener, 16) == -1) {
+		perror(path);
+		if(listener != -1) {
+			close(listener);
+		}
+		return false;
+	}
+	leading = true;
+	std::thread(accept_followers, listener).detach();
+	return true;
+}
+
+/*-------------------------------FOLLOWER-------------------------------*/
+
+static bool following = false;
+static uint64_t staleness_us;
+
+//Leader's clock when the copy was last known complete, 0 while it is not
+static std::atomic<uint64_t> synced_us(0);
+
+//Held shared by reads and exclusively while a change is applied.  Writer
+//preferring, so a steady stream of reads cannot hold changes back.
+static pthread_rwlock_t replica_lock;
+
+bool is_follower() {
+	return following;
+}
+
+bool replica_fresh() {
+	uint64_t synced = synced_us.load();
+	uint64_t now = wall_clock_us();
+	return synced != 0 && (now <= synced || now - synced <= staleness_us);
+}
+
+Replica_read_lock::Replica_read_lock() : locked(following) {
+	if(locked) {
+		pthread_rwlock_rdlock(&replica_lock);
+	}
+}
+
+Replica_read_lock::~Replica_read_lock() {
+	if(locked) {
+		pthread_rwlock_unlock(&replica_lock);
+	}
+}
+
+/*
+	Applies the leader's stream until the connection fails
+	blocks: buffer for the blocks of a message, kept across calls
+	Returns false if this server cannot follow the leader at all
+*/
+static bool follow(int fd, std::vector<char> &blocks) {
+	Repl_header header;
+	Repl_hello hello;
+	if(!recv_all(fd, &header, sizeof(header)) || header.type != REPL_HELLO ||
+	   !recv_all(fd, &hello, sizeof(hello))) {
+		return true;
+	}
+	if(hello.block_size != FS_BLOCKSIZE || hello.disk_blocks != fs_disksize) {
+		fprintf(stderr, "Leader's disk is %u blocks of %u bytes, this one %u blocks of %u bytes\n",
+			hello.disk_blocks, hello.block_size, fs_disksize, FS_BLOCKSIZE);
+		return false;
+	}
+	printf("Following leader, copying its disk\n");
+
+	while(recv_all(fd, &header, sizeof(header))) {
+		if(header.type == REPL_SYNC) {
+			if(synced_us.exchange(header.sync_us) == 0) {
+				printf("Caught up with leader\n");
+			}
+			continue;
+		}
+		if(header.type != REPL_BLOCKS) {
+			break;
+		}
+		size_t size = header.count * (sizeof(uint32_t) + FS_BLOCKSIZE);
+		blocks.resize(size);
+		if(!recv_all(fd, blocks.data(), size)) {
+			break;
+		}
+		pthread_rwlock_wrlock(&replica_lock);
+		for(const char *in = blocks.data(); in < blocks.data() + size; in += sizeof(uint32_t) + FS_BLOCKSIZE) {
+			uint32_t block;
+			memcpy(&block, in, sizeof(block));
+			if(block < fs_disksize) {
+				dev_raw_writeblock(block, in + sizeof(uint32_t));
+			}
+		}
+		pthread_rwlock_unlock(&replica_lock);
+	}
+	printf("Lost leader\n");
+	return true;
+}
+
+static void follow_loop(std::string path) {
+	sockaddr_un addr;
+	unix_address(path.c_str(), addr);
+	std::vector<char> blocks;
+	while(true) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd != -1 && connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) {
+			bool can_follow = follow(fd, blocks);
+			//Stale from now on, and partly overwritten by the next copy
+			synced_us = 0;
+			if(!can_follow) {
+				exit(1);
+			}
+		}
+		if(fd != -1) {
+			close(fd);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_MS));
+	}
+}
+
+void start_follower(const char *path, unsigned int staleness_ms) {
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&replica_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	following = true;
+	staleness_us = (uint64_t)staleness_ms * 1000;
+	std::thread(follow_loop, std::string(path)).detach();
+}
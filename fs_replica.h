@@ -0,0 +1,68 @@
+/*
+ * fs_replica.h
+ *
+ * Read replicas.  A leader server ships every block change it makes to
+ * follower servers connected to it over a Unix socket.  A follower copies
+ * the leader's whole disk when it connects, then applies the changes to
+ * its own disk in the order the leader made them, and answers
+ * FS_READBLOCK from it; every other request fails.  Any number of
+ * followers may follow one leader, each on its own disk.
+ *
+ * The leader marks the stream with the time up to which a follower has
+ * been sent every change, at least every few milliseconds.  A follower
+ * whose copy may be older than its staleness bound answers reads with
+ * FS_AGAIN, so the client can go to the leader instead; the client
+ * library does that for reads sent through fs_clientinit_replica.
+ */
+
+#ifndef _FS_REPLICA_H_
+#define _FS_REPLICA_H_
+
+#include "fs_device.h"
+
+#include <cstddef>
+
+/*
+ * Leader: accepts followers on a Unix socket at path (replacing any file
+ * there) from now on.  Must be called after init() and before requests
+ * are served.  Returns false on failure.
+ */
+bool start_leader(const char *path);
+
+/*
+ * Follower: follows the leader listening at path, connecting again
+ * whenever the connection is lost.  Reads are answered only while the
+ * copy is at most staleness_ms behind the leader.  The disk must have as
+ * many blocks as the leader's; its contents are replaced.
+ */
+void start_follower(const char *path, unsigned int staleness_ms);
+
+//True if this server is a follower
+bool is_follower();
+
+//True if a follower's copy is within its staleness bound
+bool replica_fresh();
+
+/*
+ * Called by fs_device.cpp once a change is written (or logged), so
+ * followers get the changes in the order they were made.
+ */
+void replicate_writes(const Dev_write writes[], size_t count);
+
+/*
+ * Held by a request on a follower while it reads, so it sees each change
+ * from the leader whole.  Does nothing on other servers.
+ */
+class Replica_read_lock
+{
+	public:
+		Replica_read_lock();
+		Replica_read_lock(const Replica_read_lock &) = delete;
+		Replica_read_lock &operator=(const Replica_read_lock &) = delete;
+		~Replica_read_lock();
+
+	private:
+		bool locked;
+};
+
+#endif /* _FS_REPLICA_H_ */
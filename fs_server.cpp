@@ -1,20 +1,35 @@
 #include "fs_client.h"
 #include "fs_server.h"
-#include "fs_socket.h"
 #include "fs_filesystem.h"
+#include "fs_device.h"
+#include "fs_wal.h"
+#include "helpers.h"
 
 #include <queue>
+#include <vector>
 #include <mutex>
 #include <unordered_map>
 
 std::queue<uint32_t> free_blocks;
+std::vector<bool> free_map; //true for each free block; free_blocks may also hold blocks the defragmenter took since
+uint32_t free_count = 0; //blocks set in free_map
+std::unordered_map<uint32_t, uint32_t> block_refs; //references to data blocks shared by copies (only when > 1)
 std::unordered_map<int, std::mutex> inode_locks; //can we keep a lock for eveyr inode if needed
 
 void init()
 {
+	//Create every lock up front: inode_locks[] from several threads must
+	//never insert into the map
+	for(unsigned int i = 0; i < fs_disksize; ++i) {
+		inode_locks[i];
+	}
+
+	//Finish metadata changes an earlier run left in the log
+	wal_recover();
+
     //root init
 	std::vector<bool> full_blocks;
-	full_blocks.resize(FS_DISKSIZE, false);
+	full_blocks.resize(fs_disksize, false);
     std::queue<int> q;
     fs_inode root;
     q.push(0);
@@ -22,10 +37,21 @@ void init()
     {
         uint32_t top = q.front();
 		full_blocks[top] = true;
-		disk_readblock(top, (void*)&root);
+		dev_readblock(top, (void*)&root);
         q.pop();
+		if(root.type == FS_INLINE) {
+			continue;		//no blocks besides the inode
+		}
 		if(root.type == 'f') {
 			for(unsigned int i = 0; i < root.size; ++i) {
+				if(root.blocks[i] == FS_HOLE) {
+					continue;
+				}
+				//A block reached again belongs to a copy too
+				if(full_blocks[root.blocks[i]]) {
+					uint32_t &refs = block_refs[root.blocks[i]];
+					refs = (refs == 0) ? 2 : refs + 1;
+				}
 				full_blocks[root.blocks[i]] = true;
 			}
 		}
@@ -34,7 +60,7 @@ void init()
 			for(size_t i = 0; i < root.size; ++i)
 			{
 				full_blocks[root.blocks[i]] = true;
-				disk_readblock(root.blocks[i], (void*)dir_block);
+				dev_readblock(root.blocks[i], (void*)dir_block);
 				for(unsigned int j = 0; j < FS_DIRENTRIES; ++j) {
 					if(dir_block[j].inode_block != 0) {
 						q.push(dir_block[j].inode_block);
@@ -45,26 +71,20 @@ void init()
 
     }
 
+	//FS_WAL_BLOCKS: size of the metadata log at the end of the disk, 0 (default) disables it
+	//FS_WAL_CHECKPOINT_MS: how often logged metadata is written back in place
+	long wal_blocks = env_option("FS_WAL_BLOCKS", 0);
+	if (wal_blocks > 0) {
+		wal_start(wal_blocks, env_option("FS_WAL_CHECKPOINT_MS", 1000), full_blocks);
+	}
+
+	free_map.assign(fs_disksize, false);
+	free_count = 0;
 	for(size_t i = 0; i < full_blocks.size(); ++i) {
 		if(!full_blocks[i]) {
 			free_blocks.push(i);
+			free_map[i] = true;
+			free_count++;
 		}
 	}
 }
-
-int main(int argc, const char **argv) {
-	// Parse command line arguments
-	if (argc > 2) {
-		printf("Usage: ./server port_num\n");
-		return 1;
-	}
-	int port = (argc == 2) ? atoi(argv[1]) : 0;
-
-	init();
-
-	//calls driver function that runs indefinitely
-	if (run_server(port, 30) == -1) {
-		return 1;
-	}
-	return 0;
-}
\ No newline at end of file
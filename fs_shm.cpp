@@ -0,0 +1,122 @@
+#include "fs_shm.h"
+#include "fs_socket.h"
+#include "fs_trace.h"
+#include "fs_phase.h"
+#include "fs_arena.h"
+
+#include <sys/mman.h>		// shm_open(), mmap()
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+#include <vector>
+#include <thread>
+
+static_assert(SHM_MAX_REQUEST == MAX_MESSAGE_SIZE + 1, "shared memory requests must fit what sockets take");
+
+//Waits for the client to post a request past answered
+static void wait_request(Shm_channel &channel, uint32_t answered)
+{
+	for(unsigned int spins = 0; channel.posted.load(std::memory_order_acquire) == answered; ++spins) {
+		if(spins < SHM_SPINS) {
+			shm_pause();
+			continue;
+		}
+		channel.server_sleeping.store(1);
+		if(channel.posted.load() == answered) {
+			shm_wait(channel.posted, answered);
+		}
+		channel.server_sleeping.store(0, std::memory_order_relaxed);
+	}
+}
+
+/*
+	-Called on its own thread for each channel
+	Answers the channel's requests in order, like handle_connection does
+	for a socket.  The client may be scribbling on the region, so the
+	request is copied out before it is parsed.
+*/
+static void serve_channel(Shm_channel &channel)
+{
+	char msg[MAX_MESSAGE_SIZE + 1];
+	uint32_t answered = channel.answered.load();
+
+	while(true) {
+		wait_request(channel, answered);
+		Shm_slot &slot = channel.slots[answered % SHM_RING_SLOTS];
+
+		size_t recvd = std::min<size_t>(slot.request_len, MAX_MESSAGE_SIZE);
+		memcpy(msg, slot.request, recvd);
+		msg[recvd] = '\0';
+		uint64_t arrival_us = trace_clock();
+		Trace_result result = TRACE_ERROR;
+		bool parsed;
+		{
+			Phase_request phase_request(msg);
+			Request_scope request_scope;
+
+			//There is no stream to lose track of, so a malformed request
+			//only fails itself
+			Path_list paths(request_arena());
+			{
+				Phase_RAII phase("parse");
+				parsed = parse_request(msg, recvd, paths);
+			}
+			if(parsed) {
+				//FS_READBLOCK puts the block straight into the slot
+				serve_request(msg, recvd, paths, slot.data, slot.data, result);
+			}
+			slot.status = result == TRACE_OK ? SHM_OK : result == TRACE_BUSY ? SHM_BUSY : SHM_ERROR;
+
+			Phase_RAII phase("send");
+			channel.answered.store(++answered);
+			if(channel.client_sleeping.load()) {
+				shm_wake(channel.answered);
+			}
+		}
+		if(parsed) {
+			trace_request(msg, recvd, arrival_us, result);
+		}
+	}
+}
+
+bool start_shm(const char *name) {
+	//Clients of an earlier server may still have its region mapped; give
+	//this server a fresh one so they cannot confuse it
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+	if(fd == -1) {
+		perror("Error creating shared memory");
+		return false;
+	}
+	//Any local user may connect, as on the socket
+	fchmod(fd, 0666);
+	if(ftruncate(fd, sizeof(Shm_region)) == -1) {
+		perror("Error sizing shared memory");
+		close(fd);
+		return false;
+	}
+	void *mem = mmap(nullptr, sizeof(Shm_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mem == MAP_FAILED) {
+		perror("Error mapping shared memory");
+		return false;
+	}
+
+	//The new object is zero filled, which is every channel's idle state
+	Shm_region *region = new(mem) Shm_region;
+	region->block_size = FS_BLOCKSIZE;
+	region->channels = SHM_CHANNELS;
+	region->server_pid.store(getpid());
+	for(unsigned int i = 0; i < SHM_CHANNELS; ++i) {
+		std::thread server(serve_channel, std::ref(region->channel[i]));
+		server.detach();
+	}
+	//Clients check the magic first, so write it last
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(region->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+	return true;
+}
@@ -0,0 +1,110 @@
+/*
+ * fs_shm.h
+ *
+ * Shared memory transport for clients on the same host as the file server.
+ * The server creates a POSIX shared memory object split into channels.  A
+ * client thread claims a channel and then talks to the server through the
+ * channel's ring of request slots, with futex wakeups instead of socket
+ * system calls.  The request string is the same as on a socket; the block
+ * of an FS_WRITEBLOCK or FS_READBLOCK travels in the slot's data buffer.
+ *
+ * The layout below is shared by the server and fs_client.cpp, which must be
+ * built with the same FS_BLOCKSIZE.
+ */
+
+#ifndef _FS_SHM_H_
+#define _FS_SHM_H_
+
+#include "fs_param.h"
+
+#include <linux/futex.h>	// FUTEX_WAIT, FUTEX_WAKE
+#include <sys/syscall.h>	// SYS_futex
+#include <unistd.h>		// syscall()
+#include <time.h>		// timespec
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+
+static const char SHM_MAGIC[8] = {'F', 'S', 'S', 'H', 'M', 'E', 'M', '1'};
+
+//Channels in the region, each used by one client thread at a time
+static const unsigned int SHM_CHANNELS = 16;
+
+//Requests one channel can have posted and not yet answered
+static const unsigned int SHM_RING_SLOTS = 16;
+
+//Longest request string, with its NULL (MAX_MESSAGE_SIZE + 1 on sockets)
+static const unsigned int SHM_MAX_REQUEST = 257;
+
+//Times a waiter polls before sleeping on the futex
+static const unsigned int SHM_SPINS = 200;
+
+//Shm_slot::status values
+enum Shm_status : uint32_t {
+	SHM_OK = 0,
+	SHM_ERROR = 1,		//failed or malformed, as ERROR_RESPONSE
+	SHM_BUSY = 2,		//user's queue is full, as BUSY_RESPONSE
+};
+
+struct Shm_slot {
+	uint32_t request_len;			//without the NULL
+	uint32_t status;			//Shm_status, written by the server
+	char request[SHM_MAX_REQUEST];
+	char data[FS_BLOCKSIZE] __attribute__((aligned(64)));
+};
+
+/*
+ * The client posts slot n % SHM_RING_SLOTS by filling it in and setting
+ * posted to n + 1; the server answers the slots in order, writing status
+ * (and data for a read) before setting answered to n + 1.  A side that
+ * finds nothing to do sets its sleeping flag and waits on the other
+ * side's counter, which then has to be woken after it is bumped.
+ */
+struct Shm_channel {
+	std::atomic<uint32_t> owner;		//tid of the claiming client thread, 0 if free
+	std::atomic<uint32_t> posted __attribute__((aligned(64)));
+	std::atomic<uint32_t> server_sleeping;
+	std::atomic<uint32_t> answered __attribute__((aligned(64)));
+	std::atomic<uint32_t> client_sleeping;
+	Shm_slot slots[SHM_RING_SLOTS] __attribute__((aligned(64)));
+};
+
+struct Shm_region {
+	char magic[8];
+	uint32_t block_size;			//FS_BLOCKSIZE of the server
+	uint32_t channels;
+	std::atomic<uint32_t> server_pid;
+	Shm_channel channel[SHM_CHANNELS] __attribute__((aligned(64)));
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared atomics must be lock free");
+
+//Sleeps while *word == expected, for at most timeout_ms (0 for no limit)
+inline void shm_wait(std::atomic<uint32_t> &word, uint32_t expected, long timeout_ms = 0)
+{
+	struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+	syscall(SYS_futex, &word, FUTEX_WAIT, expected, timeout_ms ? &timeout : nullptr, nullptr, 0);
+}
+
+inline void shm_wake(std::atomic<uint32_t> &word)
+{
+	syscall(SYS_futex, &word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+inline void shm_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/*
+ * Creates the shared memory object name (e.g. "/fs.alice"), replacing any
+ * left by an earlier server, and starts a thread per channel to answer
+ * requests posted to it.
+ * Returns false on failure.
+ */
+bool start_shm(const char *name);
+
+#endif /* _FS_SHM_H_ */
@@ -1,32 +1,53 @@
 #include "fs_socket.h"
 #include "fs_filesystem.h"
+#include "fs_admission.h"
+#include "fs_trace.h"
+#include "fs_phase.h"
+#include "fs_device.h"
+#include "fs_timer.h"
+#include "fs_arena.h"
+#include "fs_replica.h"
+#include "fs_lease.h"
 
 #include <stdio.h>		// printf(), perror()
 #include <stdlib.h>
 #include <arpa/inet.h>		// htons()
 #include <unistd.h>		// close()
+#include <pthread.h>		// pthread_setaffinity_np()
+#include <sched.h>		// sched_getaffinity()
 
 
 #include "helpers.h"		// make_server_sockaddr(), get_port_number()
 #include "fs_param.h"
 
-#include <sstream>
-#include <strstream>
 #include <cstring>
+#include <cctype>
+#include <algorithm>
 #include <queue>
 #include <unordered_map>
 #include<thread>
+#include <atomic>
 
 extern std::mutex q_lock;
 extern std::queue<uint32_t> free_blocks;
 extern std::unordered_map<int, std::mutex> inode_locks;
 
+//Requests currently being executed, so background work can stay out of the way
+std::atomic<int> active_requests(0);
+
+//Connections currently being served
+static std::atomic<int> open_connections(0);
+
 //cout lock when printing
 //extern std::unordered_map<int, std::mutex> inode_locks;
 
 
-int run_server(int port, int queue_size) {
-    
+/*
+	Creates a socket listening on port (0 picks a free one)
+	reuse_port: also set SO_REUSEPORT, so several sockets can share the port
+	Returns the socket, or -1 on failure
+*/
+static int open_listener(int port, int queue_size, bool reuse_port) {
 	// (1) Create socket
 	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sockfd == -1) {
@@ -36,44 +57,57 @@ int run_server(int port, int queue_size) {
 
 	// (2) Set the "reuse port" socket option
 	int yesval = 1;
-	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yesval, sizeof(yesval)) == -1) {
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yesval, sizeof(yesval)) == -1 ||
+	    (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yesval, sizeof(yesval)) == -1)) {
 		perror("Error setting socket options");
+		close(sockfd);
 		return -1;
 	}
 
-	// (3) Detect which port was chosen.
-
-
 	// (3) Create a sockaddr_in struct for the proper port and bind() to it.
 	struct sockaddr_in addr;
 	if (make_server_sockaddr(&addr, port) == -1) {
+		close(sockfd);
 		return -1;
 	}
 
 	// (3) Bind to the port.
 	if (bind(sockfd, (sockaddr *) &addr, sizeof(addr)) == -1) {
 		perror("Error binding stream socket");
+		close(sockfd);
 		return -1;
 	}
 
-	port = get_port_number(sockfd);
-
-	//printf("Server listening on port %d...\n", port);
-
-	std::cout << "\n@@@ port " << port << std::endl;
-
 	// (4) Begin listening for incoming connections.
-	listen(sockfd, queue_size);
-	// (5) Serve incoming connections one by one forever
+	if (listen(sockfd, queue_size) == -1) {
+		perror("Error listening on stream socket");
+		close(sockfd);
+		return -1;
+	}
+	return sockfd;
+}
+
+//Serves incoming connections on sockfd, each on its own thread, forever
+static void accept_loop(int sockfd, int max_connections) {
 	while (true) {
 		int connectionfd = accept(sockfd, 0, 0);
 
 		if(connectionfd != -1) {
+			//Turn the client away rather than start yet another thread,
+			//telling it to come back later if that can be done without waiting
+			if(open_connections.load() >= max_connections) {
+				send(connectionfd, BUSY_RESPONSE, sizeof(BUSY_RESPONSE), MSG_DONTWAIT | MSG_NOSIGNAL);
+				close(connectionfd);
+				continue;
+			}
+			open_connections++;
 			try {
 				std::thread first(handle_connection, connectionfd);
 				first.detach();
 			}
 			catch(...) {
+				open_connections--;
+				close(connectionfd);
 				std::cout << "handle_connection failed" << std::endl;
 			}
 		}
@@ -81,134 +115,335 @@ int run_server(int port, int queue_size) {
 	}
 }
 
-size_t receiveBytes(char msg[], int connectionfd, bool is_write) {
-	// Call recv() enough times to consume all the data the client sends.
-	size_t recvd = 0;
-	ssize_t rval;
-	do {
-		rval = recv(connectionfd, msg + recvd, 1, 0);
-		if(is_write && recvd + rval == FS_BLOCKSIZE) {
-			return FS_BLOCKSIZE;
+/*
+	Runs one acceptor pinned to cpu.  Connection threads it starts inherit
+	the pinning, so a connection is served on the core that accepted it.
+*/
+static void pinned_accept_loop(int sockfd, int max_connections, unsigned int cpu) {
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if(error != 0) {
+		fprintf(stderr, "Error pinning acceptor to cpu %u: %s\n", cpu, strerror(error));
+	}
+	accept_loop(sockfd, max_connections);
+}
+
+int run_server(int port, int queue_size, int max_connections, int acceptors) {
+	if (acceptors <= 1) {
+		int sockfd = open_listener(port, queue_size, false);
+		if (sockfd == -1) {
+			return -1;
 		}
-		if(!is_write && msg[recvd + rval-1] == '\0')
-		{
-			return recvd + rval-1;
+		std::cout << "\n@@@ port " << get_port_number(sockfd) << std::endl;
+		accept_loop(sockfd, max_connections);
+	}
+
+	//One SO_REUSEPORT socket per acceptor; the kernel spreads new
+	//connections across them.  The first one settles the port.
+	std::vector<int> listeners;
+	for (int i = 0; i < acceptors; ++i) {
+		int sockfd = open_listener(port, queue_size, true);
+		if (sockfd == -1) {
+			return -1;
 		}
-		
-		//int start = msg + recvd;
+		port = get_port_number(sockfd);
+		listeners.push_back(sockfd);
+	}
+
+	std::cout << "\n@@@ port " << port << std::endl;
+
+	//Acceptors go round the cores this process may run on
+	cpu_set_t allowed;
+	std::vector<unsigned int> cpus;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &allowed)) {
+				cpus.push_back(cpu);
+			}
+		}
+	}
+	if (cpus.empty()) {
+		cpus.push_back(0);
+	}
+	for (int i = 1; i < acceptors; ++i) {
+		std::thread acceptor(pinned_accept_loop, listeners[i], max_connections, cpus[i % cpus.size()]);
+		acceptor.detach();
+	}
+	pinned_accept_loop(listeners[0], max_connections, cpus[0]);
+	return -1;
+}
+
+size_t receiveBytes(char msg[], int connectionfd, bool is_write, Conn_timer *timer) {
+	// Call recv() until the request string's NULL (or the whole data block) arrives.
+	// Requests are read one byte at a time so the next request on this
+	// connection is left in the socket.
+	size_t limit = is_write ? FS_BLOCKSIZE : MAX_MESSAGE_SIZE + 1;
+	size_t recvd = 0;
+	while(recvd < limit) {
+		ssize_t rval = recv(connectionfd, msg + recvd, is_write ? limit - recvd : 1, 0);
 		if (rval == -1) {
 			perror("Error reading stream message");
 			return MAX_MESSAGE_SIZE + 1;
 		}
-		//std::cout << "msg rec: " << msg << std::endl;
+		if(rval == 0) {
+			// Client closed the connection, cleanly only between requests
+			return (!is_write && recvd == 0) ? 0 : MAX_MESSAGE_SIZE + 1;
+		}
+		//The connection is no longer idle once a request starts
+		if(timer && !is_write && recvd == 0) {
+			arm_timer(*timer, DEADLINE_HEADER);
+		}
 		recvd += rval;
-	} while (rval > 0);  // recv() returns 0 when client closes
+		if(!is_write && msg[recvd - 1] == '\0')
+		{
+			return recvd - 1;
+		}
+	}
 
-	return recvd;
+	return is_write ? FS_BLOCKSIZE : MAX_MESSAGE_SIZE + 1;
 }
 
 int handle_connection(int connectionfd) {
 
 	//printf("New connection %d\n", connectionfd);
 
-	// (1) Receive message from client.
-
 	char msg[MAX_MESSAGE_SIZE + 1];
-	memset(msg, 0, sizeof(msg));
 
-	size_t recvd = receiveBytes(msg, connectionfd, false);
-	//std::cout << "prerecv" << std::endl;
+	//Deadlines for the client, so a stalled one cannot hold this thread
+	Conn_timer timer(connectionfd);
 
-	if(recvd == MAX_MESSAGE_SIZE + 1) {
-		return -1;
-	}
+	// Serve requests until the client closes the connection or a request fails
+	while(true) {
+		// (1) Receive message from client.
+		memset(msg, 0, sizeof(msg));
 
-	//std::cout << "postrecv" << std::endl;
+		arm_timer(timer, DEADLINE_IDLE);
+		size_t recvd = receiveBytes(msg, connectionfd, false, &timer);
 
-    //call parsing and validating function
-	std::vector<std::string> paths;
-    if(!parse_request(msg, recvd, paths)) {
-		close(connectionfd);
-		//R TODO: return -1 for error??? or is that a different error type
-		return -1;
-	}
-	//std::cout << "postParse" << std::endl;
+		if(recvd == 0 || recvd == MAX_MESSAGE_SIZE + 1) {
+			break;
+		}
+		cancel_timer(timer);
+		//A client's cache takes its recalls on a connection of their own
+		if(strcmp(msg, "FS_LEASES") == 0) {
+			serve_lease_holder(connectionfd);
+			break;
+		}
+		uint64_t arrival_us = trace_clock();
+		Phase_request phase_request(msg);
+		//Everything the request allocates goes when the iteration ends
+		Request_scope request_scope;
+
+		//call parsing and validating function
+		//A malformed request leaves no way to find the next one, so close
+		Path_list paths(request_arena());
+		{
+			Phase_RAII phase("parse");
+			if(!parse_request(msg, recvd, paths)) {
+				break;
+			}
+		}
+
+		// (2) Print out the message
+		printf("Client %d says '%s'\n", connectionfd, msg);
+
+		//Take a write's data off the connection before touching the file
+		//system, so a slow sender never holds inode locks
+		char block_data[FS_BLOCKSIZE];
+		if(strncmp(msg, "FS_WRITEBLOCK ", 14) == 0) {
+			Phase_RAII phase("receive data");
+			arm_timer(timer, DEADLINE_PAYLOAD);
+			if(receiveBytes(block_data, connectionfd, true) != FS_BLOCKSIZE) {
+				break;
+			}
+			cancel_timer(timer);
+		}
 
-	// (2) Print out the message
-	printf("Client %d says '%s'\n", connectionfd, msg);
+		Trace_result result;
+		Req_string data = serve_request(msg, recvd, paths, block_data, nullptr, result);
 
-    std::string data = generate_response(msg, recvd, paths, connectionfd);
-	if(data == "")
-	{
-		close(connectionfd);
-		return -1;
+		{
+			Phase_RAII phase("send");
+			send(connectionfd, data.c_str(), data.size(), MSG_NOSIGNAL);
+		}
+		trace_request(msg, recvd, arrival_us, result);
 	}
 
-    send(connectionfd, data.c_str(), data.size(), MSG_NOSIGNAL);
+	//The timer must not shut down the fd once it is closed and reused
+	cancel_timer(timer);
+	if(timer.expired) {
+		printf("Client %d timed out\n", connectionfd);
+	}
 
-	// (4) Close connection
+	// (3) Close connection
 	close(connectionfd);
+	open_connections--;
 
 	return 0;
 }
 
-bool parse_request(char msg[], size_t recvd, std::vector<std::string> &paths) {
-    std::istrstream in(msg, recvd);
-    std::string command = "", username = "", pathname = "", data = "", block_string = "";
-    char null, type;
-    uint32_t block;
-
-    in >> command >> username >> pathname;
-    std::string correct_format = command + " " + username + " " + pathname;
+//Takes the next whitespace separated word off the front of rest, as
+//operator>> on a stream would, without copying it
+static std::string_view next_word(std::string_view &rest) {
+	size_t start = 0;
+	while(start < rest.size() && isspace((unsigned char)rest[start])) {
+		start++;
+	}
+	size_t end = start;
+	while(end < rest.size() && !isspace((unsigned char)rest[end])) {
+		end++;
+	}
+	std::string_view word = rest.substr(start, end - start);
+	rest.remove_prefix(end);
+	return word;
+}
 
-    if(command == "FS_WRITEBLOCK")
-    {
-        in >> block_string;
-		try {
-			block = std::stoi(block_string);
+//Reads the block number of a request; false unless word is a number
+//below FS_MAXFILEBLOCKS
+static bool parse_block(std::string_view word, uint32_t &block) {
+	if(word.empty()) {
+		return false;
+	}
+	uint64_t value = 0;
+	for(char c : word) {
+		if(c < '0' || c > '9') {
+			return false;
 		}
-		catch (...) {
+		value = value * 10 + (c - '0');
+		if(value >= FS_MAXFILEBLOCKS) {
 			return false;
 		}
-		if(block >= FS_MAXFILEBLOCKS) {
+	}
+	block = value;
+	return true;
+}
+
+//Reads the lease holder of FS_LEASEBLOCK; false unless word is a number
+static bool parse_holder(std::string_view word, uint64_t &holder) {
+	if(word.empty() || word.size() > 18) {
+		return false;
+	}
+	holder = 0;
+	for(char c : word) {
+		if(c < '0' || c > '9') {
 			return false;
 		}
-        in >> null >> data;
-        correct_format = correct_format + " " + std::to_string(block)  + data;    //right way to take in data???
-    }
-    else if(command == "FS_READBLOCK")
+		holder = holder * 10 + (c - '0');
+	}
+	return true;
+}
+
+Req_string serve_request(char msg[], size_t recvd, const Path_list &paths,
+			 char block_data[], char read_data[], Trace_result &result) {
+	//Wait for this user's turn, or answer busy if their queue is full
+	std::string_view in(msg, recvd);
+	std::string_view command = next_word(in);
+	std::string_view username = next_word(in);
+
+	bool is_read = command == "FS_READBLOCK" || command == "FS_LEASEBLOCK";
+
+	//A follower only answers reads, and only while its copy is fresh
+	if(is_follower() && command != "FS_READBLOCK") {
+		result = TRACE_ERROR;
+		return Req_string(ERROR_RESPONSE, sizeof(ERROR_RESPONSE), request_arena());
+	}
+	if(is_follower() && !replica_fresh()) {
+		result = TRACE_BUSY;
+		return Req_string(BUSY_RESPONSE, sizeof(BUSY_RESPONSE), request_arena());
+	}
+
+	bool admitted;
+	{
+		Phase_RAII phase("admission");
+		admitted = admit_request(std::string(username), is_read);
+	}
+	if(!admitted) {
+		result = TRACE_BUSY;
+		return Req_string(BUSY_RESPONSE, sizeof(BUSY_RESPONSE), request_arena());
+	}
+
+	active_requests++;
+	Req_string data(request_arena());
+	{
+		Phase_RAII phase("execute");
+		Replica_read_lock replica_lock;
+		data = generate_response(msg, recvd, paths, block_data, read_data);
+	}
+	active_requests--;
+	finish_request();
+	result = TRACE_OK;
+	if(data == "")
+	{
+		//The request was well formed, so the connection stays usable
+		data.assign(ERROR_RESPONSE, sizeof(ERROR_RESPONSE));
+		result = TRACE_ERROR;
+	}
+	return data;
+}
+
+bool parse_request(char msg[], size_t recvd, Path_list &paths) {
+    //The words point into msg, only what is built is allocated
+    std::string_view in(msg, recvd);
+    char type;
+    uint32_t block;
+
+    std::string_view command = next_word(in);
+    std::string_view username = next_word(in);
+    std::string_view pathname = next_word(in);
+    Req_string correct_format(request_arena());
+    correct_format.append(command).append(" ").append(username).append(" ").append(pathname);
+
+    if(command == "FS_WRITEBLOCK" || command == "FS_READBLOCK")
     {
-        in >> block_string;
-		try {
-			block = std::stoi(block_string);
-		}
-		catch (...) {
+		if(!parse_block(next_word(in), block)) {
 			return false;
 		}
-		if(block >= FS_MAXFILEBLOCKS) {
+        correct_format.append(" ").append(std::to_string(block));
+    }
+    else if(command == "FS_LEASEBLOCK")
+    {
+		uint64_t holder;
+		if(!parse_block(next_word(in), block) || !parse_holder(next_word(in), holder)) {
 			return false;
 		}
-        correct_format = correct_format + " " + std::to_string(block);
+        correct_format.append(" ").append(std::to_string(block)).append(" ").append(std::to_string(holder));
     }
     else if(command == "FS_CREATE")
     {
         //check space on disk
-        in >> type;
+        std::string_view word = next_word(in);
+        type = word.empty() ? '\0' : word[0];
 		if(type != 'd' && type != 'f') {
 			return false;
 		}
-        correct_format = correct_format + " " + type;
+        correct_format.append(" ").append(1, type);
     }
     else if(command == "FS_DELETE")
     {
         correct_format = correct_format;
     }
+    else if(command == "FS_DELETE_TREE")
+    {
+        correct_format = correct_format;
+    }
+    else if(command == "FS_COPY")
+    {
+        std::string_view dest = next_word(in);
+        Path_list dest_paths(request_arena());
+        if(!check_size(dest_paths, command, username, dest, "") || dest_paths[0]=="")
+        {
+            return false;
+        }
+        correct_format.append(" ").append(dest);
+    }
     else
     {
         return false;
     }
 
-	if(!check_size(paths, command, username, pathname, data) || paths[0]=="")
+	if(!check_size(paths, command, username, pathname, "") || paths[0]=="")
 	{
 		//std::cout << "check_size fail" << std::endl;
 		return false;
@@ -216,69 +451,81 @@ bool parse_request(char msg[], size_t recvd, std::vector<std::string> &paths) {
 
 
     //check correctness
-    if((std::string)msg != correct_format){
+    if(correct_format != msg){
 		//std::cout << "Not same output";
 		return false;
 	}
     return true;
 }
 
-std::string generate_response(char msg[], size_t recvd, const std::vector<std::string> &paths, int connectionfd) {
-    std::istrstream in(msg, recvd);
-    std::string command, username, pathname, data;
-    char null, type;
+Req_string generate_response(char msg[], size_t recvd, const Path_list &paths, char block_data[], char read_data[]) {
+    std::string_view in(msg, recvd);
+    char type;
     uint32_t block;
 	fs_inode i_node;
 	//fs_direntry dir_block[FS_DIRENTRIES];
 
-    in >> command >> username >> pathname;
+    std::string_view command = next_word(in);
+    std::string_view username = next_word(in);
+    std::string_view pathname = next_word(in);
 
-    std::string correct_format = command + " " + username + " " + pathname;
+    Req_string correct_format(request_arena());
+    correct_format.append(command).append(" ").append(username).append(" ").append(pathname);
 
 
 	//std::unique_lock<Lock_RAII> lck(Lock_RAII(inode_locks[0]));
-	Lock_RAII lck(&(inode_locks[0]));
+	Lock_RAII lck = lock_inode(0);
 
 	uint32_t path_num = pathTraversal(paths, i_node, command, username, lck);
 
 	//std::cout << "path returned " << path_num << std::endl;
-	if(path_num == FS_DISKSIZE) {
+	if(path_num == fs_disksize) {
 		return "";
 	}
 	//disk_readblock(path_num, (void*)&i_node);
 
     if(command == "FS_WRITEBLOCK")
     {
-        in >> block >> null;
-		char data[FS_BLOCKSIZE];
-		if (receiveBytes(data, connectionfd, true) == MAX_MESSAGE_SIZE + 1) {
-			return "";
-		}
-		std::string user_string = (std::string)i_node.owner;
-		if(!write_block(i_node, data, path_num, block)) {
+        parse_block(next_word(in), block);
+		if(!write_block(i_node, block_data, path_num, block)) {
 			return "";
 		}
 
 
-        correct_format = correct_format + " " + std::to_string(block) + '\0';
+        correct_format.append(" ").append(std::to_string(block)).append(1, '\0');
     }
-    else if(command == "FS_READBLOCK")
+    else if(command == "FS_READBLOCK" || command == "FS_LEASEBLOCK")
     {
-        in >> block;
-		char read_data[FS_BLOCKSIZE];
-		if(!read_block(i_node, read_data, path_num, block)) {
+        parse_block(next_word(in), block);
+		char block_buf[FS_BLOCKSIZE];
+		char *out = read_data ? read_data : block_buf;
+		if(!read_block(i_node, out, path_num, block)) {
 			return "";
 		}
+		//Leased while the inode is still locked, so no change slips in
+		//between the read and the lease
+		std::string_view holder_word = next_word(in);
+		uint64_t holder;
+		if(command == "FS_LEASEBLOCK" &&
+		   (!parse_holder(holder_word, holder) || !grant_lease(path_num, holder, username, pathname))) {
+			return "";
+		}
+		//Grow the response once, not by doubling through the arena
+		correct_format.reserve(recvd + 1 + (read_data ? 0 : FS_BLOCKSIZE));
 		//std::cout << "passed read_block" << std::endl;
 		//Check data size when converting
-		correct_format = correct_format + " " + std::to_string(block) + '\0';
-		for(unsigned int i = 0; i < FS_BLOCKSIZE; ++i) {
-			correct_format = correct_format + read_data[i];
+		correct_format.append(" ").append(std::to_string(block));
+		if(command == "FS_LEASEBLOCK") {
+			correct_format.append(" ").append(holder_word);
+		}
+		correct_format.append(1, '\0');
+		if(!read_data) {
+			correct_format.append(block_buf, FS_BLOCKSIZE);
 		}
     }
     else if(command == "FS_CREATE")
     {
-        in >> type;
+        type = next_word(in)[0];
 		//std::cout << "type " << type << std::endl;
 		//std::cout << "current string " << correct_format << std::endl;
 
@@ -288,53 +535,68 @@ std::string generate_response(char msg[], size_t recvd, const std::vector<std::s
 			//std::cout << "create path fail" << std::endl;
 			return "";
 		}
-        correct_format = correct_format + " " + type + '\0';
+        correct_format.append(" ").append(1, type).append(1, '\0');
     }
     else if(command == "FS_DELETE")
     {
 		if(!delete_path(i_node, path_num, paths[paths.size()-1], username)) {
 			return "";
 		}
-        correct_format = correct_format + '\0';
+        correct_format.append(1, '\0');
+    }
+    else if(command == "FS_DELETE_TREE")
+    {
+		if(!delete_tree(i_node, path_num, paths[paths.size()-1], username)) {
+			return "";
+		}
+        correct_format.append(1, '\0');
+    }
+    else if(command == "FS_COPY")
+    {
+        std::string_view dest = next_word(in);
+        Path_list dest_paths(request_arena());
+        check_size(dest_paths, command, username, dest, "");
+		if(!copy_path(i_node, dest_paths, username, lck)) {
+			return "";
+		}
+        correct_format.append(" ").append(dest).append(1, '\0');
     }
     return correct_format;
 }
 
-bool check_size(std::vector<std::string> &paths, std::string command, std::string username, std::string pathname, std::string data) {
+bool check_size(Path_list &paths, std::string_view command, std::string_view username, std::string_view pathname, std::string_view data) {
     //if(command.size() > ) return false;
     //TODO check block size?
     if(username.size() > FS_MAXUSERNAME) return false;
-	if(username == "" || username.find(" ") != std::string::npos) return false;
+	if(username == "" || username.find(" ") != std::string_view::npos) return false;
 
 	/*for(size_t i = 0; i < username.size(); ++i) {
 		if(!isalnum(username[i]))
 			return false;
 	}*/
     if(pathname.size() > FS_MAXPATHNAME) return false;
-	if(pathname[0] != '/') {
+	if(pathname.empty() || pathname[0] != '/') {
 		return false;
 	}
 
-	std::string path = "";
-	for(size_t i = 0; i < pathname.size(); ++i) {
-		if(pathname[i] == '/') {
-			for(size_t j = i + 1; j < pathname.size(); ++j) {
-				if(pathname[j] == '/') {
-					//2 slashes in a row
-					if(path.size() == 0) {
-						return false;
-					}
-					paths.push_back(path);
-					path = "";
-					i = j - 1;
-					break;
-				}
-				if(j - i > FS_MAXFILENAME)
-					return false;
-				path += pathname[j];
-			}
+	//Each component runs from just past a slash to the next one; the last
+	//may be empty when the path ends in a slash
+	paths.reserve(paths.size() + std::count(pathname.begin(), pathname.end(), '/'));
+	size_t start = 1;
+	while(true) {
+		size_t end = std::min(pathname.find('/', start), pathname.size());
+		if(end - start > FS_MAXFILENAME)
+			return false;
+		if(end == pathname.size()) {
+			paths.emplace_back(pathname.substr(start));
+			break;
+		}
+		//2 slashes in a row
+		if(end == start) {
+			return false;
 		}
+		paths.emplace_back(pathname.substr(start, end - start));
+		start = end + 1;
 	}
-	paths.push_back(path);
     return true;
 }
@@ -1,5 +1,8 @@
 #include "fs_client.h"
 #include "fs_server.h"
+#include "fs_trace.h"
+#include "fs_timer.h"
+#include "fs_arena.h"
 
 #include <sys/socket.h>     // socket(), bind(), listen(), accept(), send(), recv()
 #include <sys/types.h>
@@ -8,25 +11,47 @@
 
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 static const size_t MAX_MESSAGE_SIZE = 256;
 
+/*
+ * Sent (with its NULL) in place of the echoed request when a well formed
+ * request fails, so the client can keep using the connection.
+ */
+static const char ERROR_RESPONSE[] = "FS_ERROR";
+
+/*
+ * Sent (with its NULL) in place of the echoed request when the user already
+ * has too many requests waiting.  Nothing was done; the request may be
+ * sent again later.  As long as ERROR_RESPONSE, so clients can tell them
+ * apart after reading the same number of bytes.
+ */
+static const char BUSY_RESPONSE[] = "FS_AGAIN";
+
 /**
  * Endlessly runs a server that listens for connections and serves
- * them _synchronously_.
+ * each on its own thread.
  *
  * Parameters:
  *		port: 		The port on which to listen for incoming connections.
  *		queue_size: 	Size of the listen() queue
+ *		max_connections: Connections served at once; further ones are
+ *				closed as soon as they are accepted
+ *		acceptors:	Accept loops, each on its own SO_REUSEPORT socket
+ *				and pinned to its own core; 1 for a single
+ *				unpinned accept loop
  * Returns:
  *		-1 on failure, does not return on success.
  */
-int run_server(int port, int queue_size);
+int run_server(int port, int queue_size, int max_connections, int acceptors);
 
 /**
- * Called when run_server receives a request
- * Receives a string message from the client and prints it to stdout.
+ * Called when run_server accepts a connection
+ * Serves requests on the connection one after another, in order, until the
+ * client closes it or sends a malformed request, then closes the connection.
+ * Clients may send further requests before earlier ones are answered.
  *
  * Parameters:
  * 		connectionfd: 	File descriptor for a socket connection
@@ -36,11 +61,30 @@ int run_server(int port, int queue_size);
  */
 int handle_connection(int connectionfd);
 
-bool parse_request(char msg[], size_t recvd, std::vector<std::string> &paths);
+bool parse_request(char msg[], size_t recvd, Path_list &paths);
+
+//Executes a parsed request and returns the response, or "" if it failed
+//block_data: the data received for FS_WRITEBLOCK
+//read_data: where FS_READBLOCK puts the block, nullptr to append it to the response
+Req_string generate_response(char msg[], size_t recvd, const Path_list &paths, char block_data[], char read_data[] = nullptr);
 
-std::string generate_response(char msg[], size_t recvd, const std::vector<std::string> &paths, int connectionfd);
+/**
+ * Runs a parsed request through admission control and generate_response,
+ * the part of serving a request shared by every transport.  Must be
+ * called inside a Request_scope, which the response is allocated from.
+ *
+ * Returns:
+ *		the response to send: the echo from generate_response, or
+ *		ERROR_RESPONSE or BUSY_RESPONSE with their NULLs.
+ *		result: what trace_request should record for it.
+ */
+Req_string serve_request(char msg[], size_t recvd, const Path_list &paths,
+			 char block_data[], char read_data[], Trace_result &result);
 
 //Uses paths by reference so if check goes through, every index is a valid path
-bool check_size(std::vector<std::string> &paths, std::string command, std::string username, std::string pathname, std::string data);
+bool check_size(Path_list &paths, std::string_view command, std::string_view username, std::string_view pathname, std::string_view data);
 
-size_t receiveBytes(char msg[], int connectionfd, bool is_write);
\ No newline at end of file
+//Returns the request length (0 if the client closed the connection between
+//requests), FS_BLOCKSIZE for a write's data, or MAX_MESSAGE_SIZE + 1 on error
+//timer: given the header deadline once a request's first byte arrives
+size_t receiveBytes(char msg[], int connectionfd, bool is_write, Conn_timer *timer = nullptr);
\ No newline at end of file
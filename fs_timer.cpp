@@ -0,0 +1,188 @@
+#include "fs_timer.h"
+#include "helpers.h"
+
+#include <sys/socket.h>		// shutdown()
+#include <poll.h>		// poll()
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+//Resolution of every deadline
+static const unsigned int TICK_MS = 10;
+
+//Each level has 64 slots, each slot covering 64 times the ticks of a slot
+//on the level below, so 4 levels reach 2^24 ticks (about 46 hours)
+static const unsigned int WHEEL_BITS = 6;
+static const unsigned int WHEEL_SLOTS = 1 << WHEEL_BITS;
+static const unsigned int WHEEL_LEVELS = 4;
+static const uint64_t WHEEL_SPAN = 1ULL << (WHEEL_BITS * WHEEL_LEVELS);
+
+//Timeouts in ticks, by Conn_deadline, 0 for none
+static uint64_t timeout_ticks[3];
+static bool wheel_running = false;
+
+static std::mutex wheel_lock;		//guards everything below and every armed timer
+static std::condition_variable timers_armed;
+static Conn_timer *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t current_tick = 0;	//ticks run so far
+static unsigned int armed_count = 0;
+
+//Level and slot holding a timer that fires on tick expires
+static Conn_timer *&slot_for(uint64_t expires) {
+	uint64_t delta = expires - current_tick;
+	unsigned int level = 0;
+	while(level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1)))) {
+		level++;
+	}
+	return wheel[level][(expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+}
+
+static void link_timer(Conn_timer &timer) {
+	Conn_timer *&head = slot_for(timer.expires);
+	timer.slot = &head;
+	timer.prev = nullptr;
+	timer.next = head;
+	if(head) {
+		head->prev = &timer;
+	}
+	head = &timer;
+}
+
+static void unlink_timer(Conn_timer &timer) {
+	if(timer.next) {
+		timer.next->prev = timer.prev;
+	}
+	if(timer.prev) {
+		timer.prev->next = timer.next;
+	}
+	else {
+		*timer.slot = timer.next;
+	}
+	timer.slot = nullptr;
+	armed_count--;
+}
+
+/*	-Called with wheel_lock held-
+	Runs one tick: timers on higher levels whose slot comes round move
+	down, then the timers of this tick's bottom slot go off			*/
+static void run_tick() {
+	current_tick++;
+	for(unsigned int level = 1; level < WHEEL_LEVELS; ++level) {
+		uint64_t below = current_tick >> (WHEEL_BITS * (level - 1));
+		if((below & (WHEEL_SLOTS - 1)) != 0) {
+			break;
+		}
+		Conn_timer *&head = wheel[level][(current_tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+		Conn_timer *timer = head;
+		head = nullptr;
+		while(timer) {
+			Conn_timer *next = timer->next;
+			link_timer(*timer);
+			timer = next;
+		}
+	}
+
+	Conn_timer *&head = wheel[0][current_tick & (WHEEL_SLOTS - 1)];
+	Conn_timer *timer = head;
+	head = nullptr;
+	while(timer) {
+		Conn_timer *next = timer->next;
+		timer->slot = nullptr;
+		armed_count--;
+		//A request that has just started arriving gets the header
+		//deadline instead of being cut off, since its client cannot know
+		//the connection was about to be reaped
+		struct pollfd pfd = {timer->fd, POLLIN, 0};
+		if(timer->deadline == DEADLINE_IDLE && poll(&pfd, 1, 0) == 1) {
+			if(timeout_ticks[DEADLINE_HEADER] != 0) {
+				timer->deadline = DEADLINE_HEADER;
+				timer->expires = current_tick + timeout_ticks[DEADLINE_HEADER];
+				link_timer(*timer);
+				armed_count++;
+			}
+		}
+		else {
+			//The connection's thread sees recv() fail and closes the fd
+			timer->expired = true;
+			shutdown(timer->fd, SHUT_RDWR);
+		}
+		timer = next;
+	}
+}
+
+//Runs the wheel's ticks in step with the clock, sleeping while no timer is armed
+static void wheel_loop() {
+	std::unique_lock<std::mutex> lck(wheel_lock);
+	auto next_tick = std::chrono::steady_clock::now();
+	while(true) {
+		if(armed_count == 0) {
+			timers_armed.wait(lck, [] { return armed_count > 0; });
+			next_tick = std::chrono::steady_clock::now();
+		}
+		next_tick += std::chrono::milliseconds(TICK_MS);
+		lck.unlock();
+		std::this_thread::sleep_until(next_tick);
+		lck.lock();
+		run_tick();
+		//Catch up on ticks missed while the thread was not scheduled
+		auto now = std::chrono::steady_clock::now();
+		while(next_tick + std::chrono::milliseconds(TICK_MS) <= now) {
+			next_tick += std::chrono::milliseconds(TICK_MS);
+			run_tick();
+		}
+	}
+}
+
+void init_timeouts() {
+	long timeouts[3] = {
+		env_option("FS_IDLE_TIMEOUT_MS", 300000),
+		env_option("FS_HEADER_TIMEOUT_MS", 10000),
+		env_option("FS_PAYLOAD_TIMEOUT_MS", 10000),
+	};
+	bool any = false;
+	for(unsigned int i = 0; i < 3; ++i) {
+		if(timeouts[i] > 0) {
+			//Round up, so a deadline never comes early
+			timeout_ticks[i] = std::min<uint64_t>((timeouts[i] + TICK_MS - 1) / TICK_MS + 1, WHEEL_SPAN - 1);
+			any = true;
+		}
+	}
+	if(any) {
+		wheel_running = true;
+		std::thread ticker(wheel_loop);
+		ticker.detach();
+	}
+}
+
+void arm_timer(Conn_timer &timer, Conn_deadline deadline) {
+	if(!wheel_running) {
+		return;
+	}
+	uint64_t ticks = timeout_ticks[deadline];
+	std::lock_guard<std::mutex> lck(wheel_lock);
+	if(timer.slot) {
+		unlink_timer(timer);
+	}
+	if(ticks == 0) {
+		return;
+	}
+	timer.deadline = deadline;
+	timer.expires = current_tick + ticks;
+	link_timer(timer);
+	if(armed_count++ == 0) {
+		timers_armed.notify_one();
+	}
+}
+
+void cancel_timer(Conn_timer &timer) {
+	if(!wheel_running) {
+		return;
+	}
+	std::lock_guard<std::mutex> lck(wheel_lock);
+	if(timer.slot) {
+		unlink_timer(timer);
+	}
+}
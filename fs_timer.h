@@ -0,0 +1,60 @@
+/*
+ * fs_timer.h
+ *
+ * Deadlines for connections.  A connection waiting too long for a client
+ * (between requests, in the middle of a request string, or for a write's
+ * data) is shut down, which wakes its thread out of recv() so it can close
+ * the connection.  Deadlines are kept in a hierarchical timer wheel run by
+ * one thread, so arming, cancelling and expiring each cost O(1) however
+ * many connections are open.
+ */
+
+#ifndef _FS_TIMER_H_
+#define _FS_TIMER_H_
+
+#include <cstdint>
+
+//What a connection is waiting for
+enum Conn_deadline {
+	DEADLINE_IDLE,			//the first byte of the next request
+	DEADLINE_HEADER,		//the rest of the request string
+	DEADLINE_PAYLOAD,		//the data block of FS_WRITEBLOCK
+};
+
+/*
+ * The deadline of one connection, linked into a wheel slot while armed.
+ * Must be cancelled before the connection's fd is closed, since an armed
+ * timer may shut the fd down at any moment.
+ */
+struct Conn_timer {
+	explicit Conn_timer(int connectionfd) : fd(connectionfd) {}
+	Conn_timer(const Conn_timer &) = delete;
+	Conn_timer &operator=(const Conn_timer &) = delete;
+
+	int fd;
+	bool expired = false;			//the connection was shut down
+	//Owned by the wheel
+	Conn_deadline deadline = DEADLINE_IDLE;
+	Conn_timer *prev = nullptr;
+	Conn_timer *next = nullptr;
+	Conn_timer **slot = nullptr;		//list the timer is on, nullptr if not armed
+	uint64_t expires = 0;			//tick it fires on
+};
+
+/*
+ * Reads the timeouts from the environment and starts the wheel:
+ *	FS_IDLE_TIMEOUT_MS	between requests (default 300000)
+ *	FS_HEADER_TIMEOUT_MS	from a request's first byte to its NULL (default 10000)
+ *	FS_PAYLOAD_TIMEOUT_MS	for a write's data block (default 10000)
+ * 0 turns a timeout off.  Until this is called no deadline is enforced.
+ */
+void init_timeouts();
+
+//Sets timer to go off after the timeout for deadline, replacing any
+//deadline it had
+void arm_timer(Conn_timer &timer, Conn_deadline deadline);
+
+//Stops timer; it will not go off after this returns
+void cancel_timer(Conn_timer &timer);
+
+#endif /* _FS_TIMER_H_ */
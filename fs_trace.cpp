@@ -0,0 +1,142 @@
+#include "fs_trace.h"
+#include "fs_socket.h"
+
+#include <stdio.h>
+#include <cstring>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//A request waiting to be written out, still as the raw request string
+struct Trace_pending {
+	uint64_t arrival_us;
+	uint32_t latency_us;
+	Trace_result result;
+	uint16_t len;
+	char msg[MAX_MESSAGE_SIZE + 1];
+};
+
+//How often the writer thread empties the buffer
+static const unsigned int TRACE_FLUSH_MS = 100;
+
+//Requests buffered before further ones are dropped, so a stalled disk
+//cannot use up the server's memory
+static const size_t TRACE_MAX_PENDING = 1 << 16;
+
+static std::atomic<bool> tracing(false);
+static std::chrono::steady_clock::time_point trace_start;
+static FILE *trace_file;
+
+static std::mutex trace_lock;
+static std::vector<Trace_pending> pending;
+static uint64_t dropped = 0;
+
+uint64_t trace_clock() {
+	if(!tracing.load(std::memory_order_relaxed)) {
+		return 0;
+	}
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - trace_start).count();
+}
+
+void trace_request(const char msg[], size_t recvd, uint64_t arrival_us, Trace_result result) {
+	if(!tracing.load(std::memory_order_relaxed)) {
+		return;
+	}
+	uint64_t now = trace_clock();
+	std::lock_guard<std::mutex> lck(trace_lock);
+	if(pending.size() >= TRACE_MAX_PENDING) {
+		dropped++;
+		return;
+	}
+	pending.emplace_back();
+	Trace_pending &entry = pending.back();
+	entry.arrival_us = arrival_us;
+	entry.latency_us = (uint32_t)(now - arrival_us);
+	entry.result = result;
+	entry.len = (uint16_t)recvd;
+	memcpy(entry.msg, msg, recvd);
+}
+
+//Turns a request string into its trace record and writes it out
+static void write_record(const Trace_pending &entry) {
+	std::istringstream in(std::string(entry.msg, entry.len));
+	std::string command, username, pathname, dest;
+	in >> command >> username >> pathname;
+
+	Trace_record record = {};
+	record.arrival_us = entry.arrival_us;
+	record.latency_us = entry.latency_us;
+	record.result = entry.result;
+	//A leased read is replayed as a plain one
+	if(command == "FS_READBLOCK" || command == "FS_LEASEBLOCK" || command == "FS_WRITEBLOCK") {
+		record.command = (command == "FS_WRITEBLOCK") ? TRACE_WRITEBLOCK : TRACE_READBLOCK;
+		in >> record.block;
+	}
+	else if(command == "FS_CREATE") {
+		record.command = TRACE_CREATE;
+		in >> record.type;
+	}
+	else if(command == "FS_DELETE") {
+		record.command = TRACE_DELETE;
+	}
+	else if(command == "FS_DELETE_TREE") {
+		record.command = TRACE_DELETE_TREE;
+	}
+	else {
+		record.command = TRACE_COPY;
+		in >> dest;
+	}
+	record.user_len = username.size();
+	record.path_len = pathname.size();
+	record.dest_len = dest.size();
+
+	fwrite(&record, sizeof(record), 1, trace_file);
+	fwrite(username.data(), 1, username.size(), trace_file);
+	fwrite(pathname.data(), 1, pathname.size(), trace_file);
+	fwrite(dest.data(), 1, dest.size(), trace_file);
+}
+
+//Writes out the buffered requests every TRACE_FLUSH_MS
+static void trace_writer() {
+	std::vector<Trace_pending> batch;
+	uint64_t reported = 0;
+	while(true) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_FLUSH_MS));
+		uint64_t lost;
+		{
+			std::lock_guard<std::mutex> lck(trace_lock);
+			batch.swap(pending);
+			lost = dropped;
+		}
+		for(const Trace_pending &entry : batch) {
+			write_record(entry);
+		}
+		batch.clear();
+		fflush(trace_file);
+		if(lost != reported) {
+			fprintf(stderr, "trace: dropped %llu requests\n", (unsigned long long)lost);
+			reported = lost;
+		}
+	}
+}
+
+bool start_trace(const char *path) {
+	trace_file = fopen(path, "wb");
+	if(trace_file == nullptr) {
+		perror("Error opening trace file");
+		return false;
+	}
+	fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), trace_file);
+	pending.reserve(1024);
+	trace_start = std::chrono::steady_clock::now();
+	tracing = true;
+	std::thread writer(trace_writer);
+	writer.detach();
+	return true;
+}
@@ -0,0 +1,70 @@
+/*
+ * fs_trace.h
+ *
+ * Request tracing for the file server, and the trace file format read by
+ * fs_replay.
+ *
+ * A trace file starts with TRACE_MAGIC followed by one Trace_record per
+ * request, in the order the requests finished.  Each record is followed by
+ * its username, pathname and (for FS_COPY) destination pathname, none of
+ * them NULL terminated.  Numbers are in host byte order.  Write data is
+ * not recorded.
+ */
+
+#ifndef _FS_TRACE_H_
+#define _FS_TRACE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+static const char TRACE_MAGIC[8] = {'F', 'S', 'T', 'R', 'A', 'C', 'E', '1'};
+
+enum Trace_command : uint8_t {
+	TRACE_READBLOCK,
+	TRACE_WRITEBLOCK,
+	TRACE_CREATE,
+	TRACE_DELETE,
+	TRACE_DELETE_TREE,
+	TRACE_COPY
+};
+
+enum Trace_result : uint8_t {
+	TRACE_OK,
+	TRACE_ERROR,		// answered FS_ERROR
+	TRACE_BUSY		// answered FS_AGAIN
+};
+
+struct Trace_record {
+	uint64_t arrival_us;	// when the request arrived, since tracing started
+	uint32_t latency_us;	// from arrival until the response was sent
+	uint32_t block;		// FS_READBLOCK/FS_WRITEBLOCK block, else 0
+	uint8_t command;	// Trace_command
+	uint8_t result;		// Trace_result
+	char type;		// FS_CREATE type, else 0
+	uint8_t user_len;
+	uint8_t path_len;
+	uint8_t dest_len;
+	uint16_t reserved;
+};
+static_assert(sizeof(Trace_record) == 24, "trace records are packed");
+
+/*
+ * Starts recording every request to the file at path, which is replaced.
+ * Records are handed to a background thread that writes them out every
+ * 100 ms, so the request threads never wait on the file.  Requests from
+ * the last 100 ms before the server is killed may be missing.
+ * Returns false if the file cannot be created.
+ */
+bool start_trace(const char *path);
+
+//Microseconds since tracing started; 0 if it is off
+uint64_t trace_clock();
+
+/*
+ * Records one request if tracing is on.
+ * msg: the request string, recvd bytes long
+ * arrival_us: trace_clock() when the request arrived
+ */
+void trace_request(const char msg[], size_t recvd, uint64_t arrival_us, Trace_result result);
+
+#endif /* _FS_TRACE_H_ */
@@ -0,0 +1,286 @@
+#include "fs_server.h"
+#include "fs_filesystem.h"
+#include "fs_wal.h"
+
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+
+static const uint32_t WAL_RECORD_MAGIC = 0x43455246;	// "FREC"
+
+//Smallest log that holds the largest metadata change (a full directory
+//rewritten by the defragmenter plus its inode)
+static const uint32_t WAL_MIN_BLOCKS = 2 * FS_MAXFILEBLOCKS + 8;
+
+/*
+ * Number of block images one record header can describe
+ */
+static const unsigned int WAL_RECORD_BLOCKS = FS_BLOCKSIZE / sizeof(uint32_t) - 6;
+
+/*
+ * On-disk record header, followed in the log by "count" block images
+ */
+struct wal_record {
+    uint32_t magic;                        // WAL_RECORD_MAGIC
+    uint32_t epoch;                        // epoch the record was written in
+    uint32_t seq;                          // records are numbered from 0 in
+                                           // each epoch
+    uint32_t count;                        // block images after this header
+    uint32_t last;                         // 1 if this record finishes its
+                                           // metadata change
+    uint32_t checksum;                     // over this header (with checksum
+                                           // 0) and the images
+    uint32_t blocks[WAL_RECORD_BLOCKS];    // home block of each image
+};
+
+static_assert(sizeof(wal_record) == FS_BLOCKSIZE, "a record header is one block");
+
+typedef std::array<char, FS_BLOCKSIZE> Block_image;
+
+static std::atomic<bool> wal_enabled(false);
+
+//Serializes appends and checkpoints; everything below except overlay
+static std::mutex log_lock;
+static std::condition_variable checkpoint_needed;
+static uint32_t log_start;		//first record block
+static uint32_t log_capacity;		//record blocks (log size minus the header)
+static uint32_t log_tail;		//record blocks in use
+static uint32_t epoch;
+static uint32_t next_seq;
+static uint32_t recovered_epoch;	//epoch of the log found by wal_recover
+
+//Newest logged image of every block changed since the last checkpoint
+static std::mutex overlay_lock;
+static std::unordered_map<uint32_t, Block_image> overlay;
+
+//32-bit FNV-1a, continued from hash
+static uint32_t wal_checksum(uint32_t hash, const void *data, size_t size) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	for(size_t i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t record_checksum(wal_record record, const char *images) {
+	record.checksum = 0;
+	uint32_t hash = wal_checksum(2166136261u, &record, sizeof(record));
+	return wal_checksum(hash, images, (size_t)record.count * FS_BLOCKSIZE);
+}
+
+static void write_header(uint32_t header_epoch, uint32_t size) {
+	char block[FS_BLOCKSIZE];
+	memset(block, 0, sizeof(block));
+	wal_header *header = (wal_header *)block;
+	header->magic = WAL_MAGIC;
+	header->epoch = header_epoch;
+	header->size = size;
+	dev_raw_writeblock(fs_disksize - 1, (void*)block);
+}
+
+/*
+	Writes every logged block to its home location and empties the log.
+	Called with log_lock held, so the overlay can't change meanwhile.
+*/
+static void checkpoint_locked() {
+	if(log_tail == 0) {
+		return;
+	}
+	//Readers only look blocks up, so the overlay can be walked without
+	//overlay_lock; home writes go out in block order
+	std::vector<uint32_t> blocks;
+	blocks.reserve(overlay.size());
+	for(auto &entry : overlay) {
+		blocks.push_back(entry.first);
+	}
+	std::sort(blocks.begin(), blocks.end());
+	for(uint32_t block : blocks) {
+		dev_raw_writeblock(block, (void*)overlay.find(block)->second.data());
+	}
+
+	//The new epoch invalidates every record written so far
+	epoch++;
+	write_header(epoch, log_capacity + 1);
+	log_tail = 0;
+	next_seq = 0;
+
+	Lock_RAII overlay_mutex(&overlay_lock);
+	overlay.clear();
+}
+
+//Appends one metadata change as one or more records, with log_lock held
+static void append_locked(const Dev_write writes[], size_t count) {
+	uint32_t records = (count + WAL_RECORD_BLOCKS - 1) / WAL_RECORD_BLOCKS;
+	if(log_tail + records + count > log_capacity) {
+		checkpoint_locked();
+	}
+
+	std::vector<char> images(WAL_RECORD_BLOCKS * FS_BLOCKSIZE);
+	for(size_t first = 0; first < count; first += WAL_RECORD_BLOCKS) {
+		wal_record record;
+		memset(&record, 0, sizeof(record));
+		record.magic = WAL_RECORD_MAGIC;
+		record.epoch = epoch;
+		record.seq = next_seq++;
+		record.count = std::min<size_t>(WAL_RECORD_BLOCKS, count - first);
+		record.last = (first + record.count == count);
+		for(uint32_t i = 0; i < record.count; ++i) {
+			record.blocks[i] = writes[first + i].block;
+			memcpy(&images[i * FS_BLOCKSIZE], writes[first + i].data, FS_BLOCKSIZE);
+		}
+		record.checksum = record_checksum(record, images.data());
+
+		//The record header and its images go to consecutive blocks
+		dev_raw_writeblock(log_start + log_tail++, (void*)&record);
+		for(uint32_t i = 0; i < record.count; ++i) {
+			dev_raw_writeblock(log_start + log_tail++, (void*)&images[i * FS_BLOCKSIZE]);
+		}
+	}
+}
+
+//Checkpoints in the background so commits rarely wait for one
+static void checkpoint_loop(unsigned int checkpoint_ms) {
+	std::unique_lock<std::mutex> lck(log_lock);
+	while(true) {
+		checkpoint_needed.wait_for(lck, std::chrono::milliseconds(checkpoint_ms),
+					   [] { return log_tail > log_capacity / 2; });
+		checkpoint_locked();
+	}
+}
+
+void wal_recover() {
+	char block[FS_BLOCKSIZE];
+	dev_raw_readblock(fs_disksize - 1, (void*)block);
+	wal_header header = *(wal_header *)block;
+	if(header.magic != WAL_MAGIC || header.size < 2 || header.size > fs_disksize / 2) {
+		return;
+	}
+
+	uint32_t start = fs_disksize - header.size;
+	uint32_t capacity = header.size - 1;
+	uint32_t pos = 0, seq = 0, changes = 0;
+	std::vector<std::pair<uint32_t, Block_image>> pending;
+	std::vector<char> images(WAL_RECORD_BLOCKS * FS_BLOCKSIZE);
+	while(pos < capacity) {
+		wal_record record;
+		dev_raw_readblock(start + pos, (void*)&record);
+		if(record.magic != WAL_RECORD_MAGIC || record.epoch != header.epoch ||
+		   record.seq != seq || record.count > WAL_RECORD_BLOCKS ||
+		   pos + 1 + record.count > capacity) {
+			break;
+		}
+		for(uint32_t i = 0; i < record.count; ++i) {
+			dev_raw_readblock(start + pos + 1 + i, (void*)&images[i * FS_BLOCKSIZE]);
+		}
+		//A record torn by a crash ends the log
+		if(record.checksum != record_checksum(record, images.data())) {
+			break;
+		}
+		for(uint32_t i = 0; i < record.count; ++i) {
+			Block_image image;
+			memcpy(image.data(), &images[i * FS_BLOCKSIZE], FS_BLOCKSIZE);
+			pending.emplace_back(record.blocks[i], image);
+		}
+		if(record.last) {
+			for(auto &write : pending) {
+				dev_raw_writeblock(write.first, (void*)write.second.data());
+			}
+			pending.clear();
+			changes++;
+		}
+		pos += 1 + record.count;
+		seq++;
+	}
+
+	//The log's blocks are free again unless wal_start claims them
+	memset(block, 0, sizeof(block));
+	dev_raw_writeblock(fs_disksize - 1, (void*)block);
+	recovered_epoch = header.epoch;
+	std::cout << "wal: replayed " << changes << " metadata changes" << std::endl;
+}
+
+bool wal_start(uint32_t log_blocks, unsigned int checkpoint_ms, std::vector<bool> &full_blocks) {
+	log_blocks = std::max(log_blocks, WAL_MIN_BLOCKS);
+	if(log_blocks > fs_disksize / 2) {
+		std::cout << "wal: log of " << log_blocks << " blocks is too large" << std::endl;
+		return false;
+	}
+	uint32_t first = fs_disksize - log_blocks;
+	for(uint32_t i = first; i < fs_disksize; ++i) {
+		if(full_blocks[i]) {
+			std::cout << "wal: block " << i << " is in use, running without the log" << std::endl;
+			return false;
+		}
+	}
+	for(uint32_t i = first; i < fs_disksize; ++i) {
+		full_blocks[i] = true;
+	}
+
+	log_start = first;
+	log_capacity = log_blocks - 1;
+	log_tail = 0;
+	next_seq = 0;
+	//Never reuse an epoch that stale records on disk might carry
+	epoch = recovered_epoch ? recovered_epoch + 1 : (uint32_t)time(nullptr);
+	write_header(epoch, log_blocks);
+	wal_enabled = true;
+
+	std::thread(checkpoint_loop, checkpoint_ms).detach();
+	return true;
+}
+
+uint32_t wal_first_block() {
+	return wal_enabled ? log_start : fs_disksize;
+}
+
+bool wal_readblock(uint32_t block, void *buf) {
+	if(!wal_enabled) {
+		return false;
+	}
+	Lock_RAII overlay_mutex(&overlay_lock);
+	auto entry = overlay.find(block);
+	if(entry == overlay.end()) {
+		return false;
+	}
+	memcpy(buf, entry->second.data(), FS_BLOCKSIZE);
+	return true;
+}
+
+bool wal_absorb(uint32_t block, const void *buf) {
+	if(!wal_enabled) {
+		return false;
+	}
+	{
+		//A block with a logged image must keep going through the log, or a
+		//checkpoint or replay would overwrite this write with the old image
+		Lock_RAII overlay_mutex(&overlay_lock);
+		if(overlay.find(block) == overlay.end()) {
+			return false;
+		}
+	}
+	Dev_write write = {block, buf};
+	return wal_commit(&write, 1);
+}
+
+bool wal_commit(const Dev_write writes[], size_t count) {
+	if(!wal_enabled) {
+		return false;
+	}
+	Lock_RAII log_mutex(&log_lock);
+	append_locked(writes, count);
+
+	Lock_RAII overlay_mutex(&overlay_lock);
+	for(size_t i = 0; i < count; ++i) {
+		memcpy(overlay[writes[i].block].data(), writes[i].data, FS_BLOCKSIZE);
+	}
+	if(log_tail > log_capacity / 2) {
+		checkpoint_needed.notify_one();
+	}
+	return true;
+}
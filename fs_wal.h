@@ -0,0 +1,63 @@
+/*
+ * fs_wal.h
+ *
+ * Write-ahead log for metadata changes.
+ *
+ * The log occupies the last blocks of the disk.  The very last block is the
+ * log header; the blocks before it hold log records, each a record header
+ * block followed by the images of the blocks it changes.  A metadata change
+ * is finished once its records are appended to the log.  The changed blocks
+ * are written to their home locations later by a background checkpoint, and
+ * until then reads of those blocks are answered from memory.
+ */
+
+#ifndef _FS_WAL_H_
+#define _FS_WAL_H_
+
+#include "fs_device.h"
+
+#include <cstdint>
+#include <vector>
+
+static const uint32_t WAL_MAGIC = 0x4c415746;		// "FWAL"
+
+/*
+ * On-disk log header, stored in the last block of the disk.  A header
+ * without WAL_MAGIC means there is no log.
+ */
+struct wal_header {
+    uint32_t magic;                        // WAL_MAGIC
+    uint32_t epoch;                        // only records of this epoch are
+                                           // valid; bumped by each checkpoint
+    uint32_t size;                         // blocks in the log, including
+                                           // this header
+};
+
+/*
+ * Replays the log left on disk by an earlier run, if there is one, and then
+ * clears it.  Must run before anything else reads the file system.
+ */
+void wal_recover();
+
+/*
+ * Puts a log of log_blocks blocks at the end of the disk and starts the
+ * checkpoint thread, which checkpoints every checkpoint_ms milliseconds
+ * (and whenever the log fills up).
+ * full_blocks: the blocks in use by the file system; the log's blocks are
+ * added to it.
+ * Returns false (and leaves the log off) if those blocks are in use.
+ */
+bool wal_start(uint32_t log_blocks, unsigned int checkpoint_ms, std::vector<bool> &full_blocks);
+
+//First block of the log, fs_disksize when the log is off
+uint32_t wal_first_block();
+
+/*
+ * Used by fs_device.cpp.  Each returns false when the log does not handle
+ * the call, and the block must be read or written on the disk directly.
+ */
+bool wal_readblock(uint32_t block, void *buf);
+bool wal_absorb(uint32_t block, const void *buf);
+bool wal_commit(const Dev_write writes[], size_t count);
+
+#endif /* _FS_WAL_H_ */
@@ -6,6 +6,7 @@
 #include <string.h>		// memcpy()
 #include <sys/socket.h>		// getsockname()
 #include <unistd.h>		// stderr
+#include <stdlib.h>		// getenv(), strtol()
 
 /**
  * Make a server sockaddr given a port.
@@ -88,4 +89,28 @@ int make_client_sockaddr(struct sockaddr_in *addr, const char *hostname, int por
 	}
 	// Use ntohs to convert from network byte order to host byte order.
 	return ntohs(addr.sin_port);
- }
\ No newline at end of file
+ }
+
+/**
+ * Read a numeric server option from the environment.
+ *
+ * Parameters:
+ * 		name:	Name of the environment variable
+ * 		def:	Value to use if the variable is unset or not a number
+ *
+ * Returns:
+ *		The option's value.
+ */
+long env_option(const char *name, long def) {
+	const char *value = getenv(name);
+	if (value == nullptr || *value == '\0') {
+		return def;
+	}
+	char *end;
+	long parsed = strtol(value, &end, 10);
+	if (*end != '\0') {
+		fprintf(stderr, "%s: ignoring invalid value '%s'\n", name, value);
+		return def;
+	}
+	return parsed;
+}
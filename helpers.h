@@ -11,4 +11,6 @@ int make_server_sockaddr(struct sockaddr_in *addr, int port);
 
 int make_client_sockaddr(struct sockaddr_in *addr, const char *hostname, int port);
 
- int get_port_number(int sockfd);
\ No newline at end of file
+ int get_port_number(int sockfd);
+
+long env_option(const char *name, long def);
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include "ram_disk.h"
+#include "fs_server.h"
+
+#include <cassert>
+#include <cstring>
+#include <mutex>
+
+//Blocks are guarded by a fixed set of locks, so readers never see half a write
+static const unsigned int RAM_DISK_LOCKS = 64;
+
+static char ram_disk[FS_DISKSIZE][FS_BLOCKSIZE];
+static std::mutex ram_disk_locks[RAM_DISK_LOCKS];
+
+std::mutex cout_lock;
+
+void disk_readblock(unsigned int block, void *buf) {
+	assert(block < FS_DISKSIZE);
+	std::lock_guard<std::mutex> lck(ram_disk_locks[block % RAM_DISK_LOCKS]);
+	memcpy(buf, ram_disk[block], FS_BLOCKSIZE);
+}
+
+void disk_writeblock(unsigned int block, const void *buf) {
+	assert(block < FS_DISKSIZE);
+	std::lock_guard<std::mutex> lck(ram_disk_locks[block % RAM_DISK_LOCKS]);
+	memcpy(ram_disk[block], buf, FS_BLOCKSIZE);
+}
+
+void ram_disk_format() {
+	memset(ram_disk, 0, sizeof(ram_disk));
+	fs_inode root = {};
+	root.type = 'd';
+	memcpy(ram_disk[0], &root, sizeof(root));
+}
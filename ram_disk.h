@@ -0,0 +1,18 @@
+/*
+ * ram_disk.h
+ *
+ * In-memory stand-in for the disk half of libfs_server.o (disk_readblock,
+ * disk_writeblock and cout_lock), so the file system code can be run
+ * without a disk file, e.g. by fs_bench.
+ */
+
+#ifndef _RAM_DISK_H_
+#define _RAM_DISK_H_
+
+/*
+ * Clears the disk and writes an empty file system on it, like createfs:
+ * block 0 holds an empty root directory owned by no one.
+ */
+void ram_disk_format();
+
+#endif /* _RAM_DISK_H_ */
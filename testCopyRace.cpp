@@ -0,0 +1,71 @@
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fs_client.h"
+
+using std::cout;
+
+// Copies a file over and over while other threads read it.  FS_COPY
+// must not take the root lock while it holds the file's, or a reader
+// holding the root and waiting for the file deadlocks with it.  Start the
+// server with FS_MAX_ACTIVE=64 or so, since on a machine with few cores
+// admission control alone may keep the requests from overlapping.
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        cout << "error: usage: " << argv[0] << " <server> <serverPort>\n";
+        exit(1);
+    }
+    fs_clientinit(argv[1], atoi(argv[2]));
+
+    char writedata[FS_BLOCKSIZE];
+    memset(writedata, 'c', sizeof(writedata));
+    assert(!fs_create("user1", "/f", 'f'));
+    assert(!fs_writeblock("user1", "/f", 0, writedata));
+
+    std::atomic<bool> stop(false);
+    std::atomic<long> copies(0), reads(0);
+
+    std::thread copier([&] {
+        for (long i = 0; !stop; ++i) {
+            std::string dest = "/c" + std::to_string(i % 8);
+            assert(!fs_copy("user1", "/f", dest.c_str()));
+            assert(!fs_delete("user1", dest.c_str()));
+            copies++;
+        }
+    });
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            char readdata[FS_BLOCKSIZE];
+            while (!stop) {
+                assert(!fs_readblock("user1", "/f", 0, readdata));
+                assert(!memcmp(readdata, writedata, FS_BLOCKSIZE));
+                reads++;
+            }
+        });
+    }
+
+    // Both sides must keep going for the whole run
+    for (int second = 0; second < 5; ++second) {
+        long copies_before = copies, reads_before = reads;
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if (copies == copies_before || reads == reads_before) {
+            cout << "stalled after " << copies << " copies and " << reads << " reads\n";
+            exit(1);
+        }
+    }
+    stop = true;
+    copier.join();
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+    cout << copies << " copies, " << reads << " reads\n";
+    return 0;
+}